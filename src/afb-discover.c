@@ -26,46 +26,419 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-#include <ctype.h>
-#include <dirent.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include <libafb/sys/x-mutex.h>
+
+#include "afb-discover.h"
+
+/*
+ * The processes known as matching or not are cached between scans.
+ * At each scan, only the new processes are checked, plus a slice
+ * of 1/DISCOVER_REVALIDATE_PERIOD of the cached ones so that pids
+ * reused or processes executing a new program are detected after
+ * at most DISCOVER_REVALIDATE_PERIOD scans. The matching processes
+ * are revalidated by their start time.
+ */
+#define DISCOVER_REVALIDATE_PERIOD 16
+
+/* size of the buffer for reading directory entries */
+#define DISCOVER_BUFFER_SIZE 32768
+
+/* entry read by getdents64 */
+struct dirent64_entry
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* a process matching */
+struct match
+{
+	/* its pid */
+	pid_t pid;
+
+	/* its start time in clock ticks since boot, 0 if unknown */
+	uint64_t start;
+};
+
+/* cache of the scans */
+static struct {
+	/* the lock */
+	x_mutex_t mutex;
+
+	/* the root of the proc filesystem */
+	const char *root;
+
+	/* the directory of the root */
+	int procfd;
+
+	/* the pattern of the cached pids */
+	const char *pattern;
+
+	/* count of scans */
+	unsigned scans;
+
+	/* sorted array of pids not matching */
+	pid_t *pids;
+
+	/* count of pids in the array */
+	unsigned count;
+
+	/* allocated size of the array */
+	unsigned size;
+
+	/* sorted array of processes matching */
+	struct match *matches;
+
+	/* count of processes in the array */
+	unsigned nmatches;
+
+	/* allocated size of the array */
+	unsigned szmatches;
+}
+	cache = { .mutex = X_MUTEX_INITIALIZER, .root = "/proc", .procfd = -1 };
+
+/**
+ * Checks whether the executable link 'lnk' has the basename 'pattern'.
+ * Returns 1 if it matches or 0 otherwise.
+ */
+static int link_matches(char *lnk, const char *pattern)
+{
+	char *name = lnk;
+
+	while(*name) {
+		while(*name == '/')
+			name++;
+		if (*name) {
+			if (!strcmp(name, pattern))
+				return 1;
+			while(*++name && *name != '/');
+		}
+	}
+	return 0;
+}
+
+/**
+ * Checks whether the executable of path 'exe' relative to 'dirfd'
+ * has the basename 'pattern'.
+ * Returns 1 if it matches, 0 if not or a negative value if unreadable.
+ */
+static int exe_matches(int dirfd, const char *exe, const char *pattern)
+{
+	ssize_t n;
+	char lnk[PATH_MAX];
+
+	n = readlinkat(dirfd, exe, lnk, sizeof lnk);
+	if (n < 0 || (size_t)n >= sizeof lnk)
+		return -1;
+	lnk[n] = 0;
+	return link_matches(lnk, pattern);
+}
+
+/**
+ * Gets in 'start' the start time of the process whose stat file has
+ * the 'path' relative to 'dirfd'.
+ * Returns 0 on success or a negative error code.
+ */
+static int start_time_at(int dirfd, const char *path, uint64_t *start)
+{
+	char buffer[1024], *p, *end;
+	ssize_t len;
+	int fd, field;
+
+	fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, buffer, sizeof buffer - 1);
+	close(fd);
+	if (len <= 0)
+		return len < 0 ? -errno : -ENODATA;
+	buffer[len] = 0;
+
+	/* the command (field 2) is enclosed in parentheses and can contain spaces */
+	p = strrchr(buffer, ')');
+	for (field = 2 ; p && field < 22 ; field++)
+		p = strchr(&p[1], ' ');
+	if (!p)
+		return -EINVAL;
+	*start = strtoull(&p[1], &end, 10);
+	return end == &p[1] ? -EINVAL : 0;
+}
+
+static int cmp_pids(const void *a, const void *b)
+{
+	pid_t x = *(const pid_t*)a, y = *(const pid_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static int cmp_matches(const void *a, const void *b)
+{
+	return cmp_pids(&((const struct match*)a)->pid, &((const struct match*)b)->pid);
+}
+
+/**
+ * Appends 'pid' to the array 'pids' of 'count' items for 'size'.
+ */
+static void append_pid(pid_t **pids, unsigned *count, unsigned *size, pid_t pid)
+{
+	pid_t *p;
+	unsigned s;
+
+	if (*count == *size) {
+		s = *size ? *size << 1 : 1024;
+		p = realloc(*pids, s * sizeof *p);
+		if (!p)
+			return; /* not cached, will be checked again */
+		*pids = p;
+		*size = s;
+	}
+	(*pids)[(*count)++] = pid;
+}
+
+/**
+ * Appends the process 'pid' started at 'start' to the array 'matches'
+ * of 'count' items for 'size'.
+ */
+static void append_match(struct match **matches, unsigned *count, unsigned *size, pid_t pid, uint64_t start)
+{
+	struct match *m;
+	unsigned s;
+
+	if (*count == *size) {
+		s = *size ? *size << 1 : 64;
+		m = realloc(*matches, s * sizeof *m);
+		if (!m)
+			return; /* not cached, will be checked again */
+		*matches = m;
+		*size = s;
+	}
+	m = &(*matches)[(*count)++];
+	m->pid = pid;
+	m->start = start;
+}
 
 void afs_discover(const char *pattern, void (*callback)(void *closure, pid_t pid), void *closure)
 {
-	intmax_t n;
-	DIR *dir;
-	struct dirent *ent;
+	char buffer[DISCOVER_BUFFER_SIZE] __attribute__((aligned(8)));
+	char path[32];
+	struct dirent64_entry *ent;
+	struct match *m, *matches;
+	long len, pos;
+	pid_t pid, last, lastm, *pids;
+	unsigned count, size, nmatches, szmatches, slice;
+	uint64_t start;
+	size_t nlen;
+	int sorted, sortedm, revalidate, rc;
 	char *name;
-	char exe[PATH_MAX], lnk[PATH_MAX];
 
-	dir = opendir("/proc");
-	while ((ent = readdir(dir))) {
-		name = ent->d_name;
-		while (isdigit(*name))
-			name++;
-		if (*name)
-			continue;
-		n = snprintf(exe, sizeof exe, "/proc/%s/exe", ent->d_name);
-		if (n < 0 || (size_t)n >= sizeof exe)
-			continue;
-		n = readlink(exe, lnk, sizeof lnk);
-		if (n < 0 || (size_t)n >= sizeof lnk)
-			continue;
-		lnk[n] = 0;
-		name = lnk;
-		while(*name) {
-			while(*name == '/')
-				name++;
-			if (*name) {
-				if (!strcmp(name, pattern)) {
-					callback(closure, (pid_t)atoi(ent->d_name));
-					break;
+	x_mutex_lock(&cache.mutex);
+
+	/* open or rewind the directory */
+	if (cache.procfd < 0)
+		cache.procfd = open(cache.root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	else
+		lseek(cache.procfd, 0, SEEK_SET);
+	if (cache.procfd < 0) {
+		x_mutex_unlock(&cache.mutex);
+		return;
+	}
+
+	/* drop the cache on pattern change */
+	if (cache.pattern != pattern && (!cache.pattern || strcmp(cache.pattern, pattern)))
+		cache.count = cache.nmatches = 0;
+	cache.pattern = pattern;
+	slice = cache.scans++ % DISCOVER_REVALIDATE_PERIOD;
+
+	/* scan the entries */
+	pids = NULL;
+	matches = NULL;
+	count = size = nmatches = szmatches = 0;
+	sorted = sortedm = 1;
+	last = lastm = 0;
+	while ((len = syscall(SYS_getdents64, cache.procfd, buffer, sizeof buffer)) > 0) {
+		for (pos = 0 ; pos < len ; pos += ent->d_reclen) {
+			ent = (struct dirent64_entry*)&buffer[pos];
+
+			/* get the pid */
+			pid = 0;
+			for (name = ent->d_name ; '0' <= *name && *name <= '9' ; name++)
+				pid = 10 * pid + (*name - '0');
+			if (*name || !pid)
+				continue;
+
+			/* check it if new or to be revalidated */
+			revalidate = (unsigned)pid % DISCOVER_REVALIDATE_PERIOD == slice;
+			m = bsearch(&pid, cache.matches, cache.nmatches, sizeof *m, cmp_matches);
+			if (m && !revalidate) {
+				start = m->start;
+				rc = 1;
+			}
+			else if (!m && !revalidate && bsearch(&pid, cache.pids, cache.count, sizeof pid, cmp_pids))
+				rc = 0;
+			else {
+				nlen = (size_t)(name - ent->d_name);
+				if (nlen + sizeof "/stat" > sizeof path)
+					continue;
+				memcpy(path, ent->d_name, nlen);
+				rc = 0;
+				if (m) {
+					/* still the same process if started at the same time */
+					memcpy(&path[nlen], "/stat", sizeof "/stat");
+					rc = start_time_at(cache.procfd, path, &start) == 0 && start == m->start;
+				}
+				if (!rc) {
+					memcpy(&path[nlen], "/exe", sizeof "/exe");
+					rc = exe_matches(cache.procfd, path, pattern);
+					memcpy(&path[nlen], "/stat", sizeof "/stat");
+					if (rc > 0 && start_time_at(cache.procfd, path, &start) < 0)
+						start = 0;
 				}
-				while(*++name && *name != '/');
+			}
+
+			/* record it as matching or not */
+			if (rc > 0) {
+				append_match(&matches, &nmatches, &szmatches, pid, start);
+				sortedm = sortedm && lastm < pid;
+				lastm = pid;
+				callback(closure, pid);
+			}
+			else {
+				append_pid(&pids, &count, &size, pid);
+				sorted = sorted && last < pid;
+				last = pid;
 			}
 		}
 	}
-	closedir(dir);
+
+	/* replace the cache, forgetting vanished pids */
+	if (!sorted)
+		qsort(pids, count, sizeof *pids, cmp_pids);
+	free(cache.pids);
+	cache.pids = pids;
+	cache.count = count;
+	cache.size = size;
+	if (!sortedm)
+		qsort(matches, nmatches, sizeof *matches, cmp_matches);
+	free(cache.matches);
+	cache.matches = matches;
+	cache.nmatches = nmatches;
+	cache.szmatches = szmatches;
+
+	x_mutex_unlock(&cache.mutex);
 }
 
+int afs_discover_check(pid_t pid, const char *pattern)
+{
+	char exe[PATH_MAX];
+
+	snprintf(exe, sizeof exe, "%s/%d/exe", cache.root, (int)pid);
+	return exe_matches(AT_FDCWD, exe, pattern) > 0;
+}
+
+int afs_discover_start_time(pid_t pid, uint64_t *start)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof path, "%s/%d/stat", cache.root, (int)pid);
+	return start_time_at(AT_FDCWD, path, start);
+}
+
+void afs_discover_set_root(const char *root)
+{
+	x_mutex_lock(&cache.mutex);
+	if (cache.procfd >= 0)
+		close(cache.procfd);
+	cache.procfd = -1;
+	cache.root = root ?: "/proc";
+	cache.count = cache.nmatches = 0;
+	x_mutex_unlock(&cache.mutex);
+}
+
+/* message for subscribing to the proc connector */
+struct __attribute__((aligned(NLMSG_ALIGNTO))) proc_cn_subscribe
+{
+	struct nlmsghdr nl_hdr;
+	struct __attribute__((__packed__)) {
+		struct cn_msg cn_msg;
+		enum proc_cn_mcast_op cn_mcast;
+	};
+};
+
+int afs_discover_watch_open()
+{
+	int fd, rc;
+	struct sockaddr_nl addr;
+	struct proc_cn_subscribe msg;
+
+	/* create the netlink socket of the connector */
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (fd < 0)
+		return -errno;
+
+	/* join the group of process events */
+	memset(&addr, 0, sizeof addr);
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = 0;
+	rc = bind(fd, (struct sockaddr*)&addr, sizeof addr);
+	if (rc == 0) {
+		/* subscribe to the events */
+		memset(&msg, 0, sizeof msg);
+		msg.nl_hdr.nlmsg_len = sizeof msg;
+		msg.nl_hdr.nlmsg_pid = 0;
+		msg.nl_hdr.nlmsg_type = NLMSG_DONE;
+		msg.cn_msg.id.idx = CN_IDX_PROC;
+		msg.cn_msg.id.val = CN_VAL_PROC;
+		msg.cn_msg.len = sizeof(enum proc_cn_mcast_op);
+		msg.cn_mcast = PROC_CN_MCAST_LISTEN;
+		if (send(fd, &msg, sizeof msg, 0) == (ssize_t)sizeof msg)
+			return fd;
+	}
+	rc = -errno;
+	close(fd);
+	return rc;
+}
+
+int afs_discover_watch_read(int fd, void (*callback)(void *closure, pid_t pid), void *closure)
+{
+	char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	ssize_t len;
+	struct nlmsghdr *nlh;
+	struct cn_msg *cn;
+	struct proc_event *ev;
+
+	for (;;) {
+		len = recv(fd, buffer, sizeof buffer, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* ENOBUFS means that events were lost */
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -errno;
+		}
+		if (len == 0)
+			return 0;
+		for (nlh = (struct nlmsghdr*)buffer ; NLMSG_OK(nlh, len) ; nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_NOOP)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_OVERRUN)
+				return -ENOBUFS;
+			cn = NLMSG_DATA(nlh);
+			ev = (struct proc_event*)cn->data;
+			if (ev->what == PROC_EVENT_EXEC)
+				callback(closure, ev->event_data.exec.process_tgid);
+		}
+	}
+}
@@ -23,5 +23,49 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Scans the processes and calls 'callback' for each one whose
+ * executable has the basename 'pattern'. The processes found are
+ * cached: a pid reused since the previous scan can be reported
+ * until revalidated, so check it with afs_discover_check before
+ * acting on a process not known otherwise.
+ */
 extern void afs_discover(const char *pattern, void (*callback)(void *closure, pid_t pid), void *closure);
 
+/**
+ * Checks whether the executable of the process 'pid' has the basename 'pattern'.
+ * Returns 1 if it matches or 0 otherwise.
+ */
+extern int afs_discover_check(pid_t pid, const char *pattern);
+
+/**
+ * Gets in 'start' the start time of the process 'pid' in clock ticks
+ * since boot. Together with the pid, it identifies a process.
+ * Returns 0 on success or a negative error code.
+ */
+extern int afs_discover_start_time(pid_t pid, uint64_t *start);
+
+/**
+ * Sets the directory 'root' where processes are scanned,
+ * NULL for the default "/proc"
+ */
+extern void afs_discover_set_root(const char *root);
+
+/**
+ * Opens a socket to the kernel's proc connector for being notified
+ * of the processes executing a new program. Requires CAP_NET_ADMIN.
+ * Returns the socket or a negative error code.
+ */
+extern int afs_discover_watch_open();
+
+/**
+ * Reads the pending events of the proc connector socket 'fd' and calls
+ * 'callback' for each process that executed a new program.
+ * Returns 0 when all pending events are read or a negative error code.
+ * The error -ENOBUFS means that some events were lost.
+ */
+extern int afs_discover_watch_read(int fd, void (*callback)(void *closure, pid_t pid), void *closure);
+
@@ -21,9 +21,15 @@
  * $RP_END_LICENSE$
  */
 
+#include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <fnmatch.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -39,6 +45,7 @@
 #include <libafb/core/afb-apiset.h>
 #include <libafb/core/afb-data.h>
 #include <libafb/core/afb-type.h>
+#include <libafb/core/afb-type-predefined.h>
 #include <libafb/core/afb-evt.h>
 #include <libafb/core/afb-json-legacy.h>
 #include <libafb/wsapi/afb-stub-ws.h>
@@ -49,6 +56,7 @@
 
 #include <libafb/misc/afb-verbose.h>
 #include <libafb/sys/x-socket.h>
+#include <libafb/sys/x-rwlock.h>
 #include <libafb/sys/x-mutex.h>
 #include <libafb/sys/x-errno.h>
 
@@ -56,12 +64,41 @@
 
 #include "afb-supervisor-api.h"
 #include "afb-discover.h"
+#include "afb-supervisor-call.h"
+#include "afb-supervisor-wakeup.h"
+#include "afb-supervisor-trace.h"
+#include "afb-supervisor-stats.h"
+#include "afb-supervisor-metrics.h"
+#include "afb-supervisor-snapshot.h"
+#include "afb-supervisor-handoff.h"
+#include "afb-supervisor-federation.h"
+#include "afb-supervisor-sessions.h"
+#include "afb-supervisor-health.h"
+
+/* slots of the cached replies of superviseds */
+#define CACHE_NONE    -1  /* not cached */
+#define CACHE_CONFIG   0  /* reply to config */
+#define CACHE_APIS     1  /* reply to do monitor/get {"apis":true} */
+#define CACHE_COUNT    2  /* count of slots */
+
+/* a cached reply */
+struct cached
+{
+	/* the reply serialized or NULL */
+	struct afb_data *data;
+
+	/* expiration time in us */
+	uint64_t expire_us;
+};
 
 /* supervised items */
 struct supervised
 {
-	/* link to the next supervised */
-	struct supervised *next;
+	/* link to the next supervised of the same pid bucket */
+	struct supervised *next_pid;
+
+	/* link to the next supervised of the same stub bucket */
+	struct supervised *next_stub;
 
 	/* credentials of the supervised */
 	struct afb_cred *cred;
@@ -69,8 +106,20 @@ struct supervised
 	/* connection with the supervised */
 	struct afb_stub_ws *stub;
 
+	/* listener of the trace events of the supervised */
+	struct afb_evt_listener *tracer;
+
+	/* the cached replies (protected by cache.mutex) */
+	struct cached cached[CACHE_COUNT];
+
+	/* reference count */
+	unsigned refcount;
+
 	/* pid */
 	int pid;
+
+	/* socket of the connection */
+	int fd;
 };
 
 /* api and apiset name */
@@ -80,87 +129,366 @@ static const char supervisor_apiname[] = AFB_SUPERVISOR_APINAME;
 /* the empty apiset */
 static struct afb_apiset *empty_apiset;
 
+/* basename of the executable of the daemons to supervise */
+static const char daemon_pattern[] = "afb-daemon";
+
+/* delay in ms before waking up a daemon watched starting */
+#define WATCH_WAKEUP_DELAY_MS 1000
+
+/* proc connector watching daemons starting */
+static struct ev_fd *watch_efd;
+
 /* supervision socket path */
-static const char supervision_socket_path[] = "unix:" AFB_SUPERVISOR_SOCKET;
+static const char default_supervision_socket_path[] = "unix:" AFB_SUPERVISOR_SOCKET;
+static const char *supervision_socket_path = default_supervision_socket_path;
 static struct ev_fd *supervision_efd;
+static int supervision_fd = -1;
+
+/* initial count of buckets of the registry (must be a power of 2) */
+#define REGISTRY_INITIAL_BUCKETS 64
+
+/* count of entries of the log of changes (must be a power of 2) */
+#define CHANGES_LOG_SIZE 1024
+
+/* operations of changes */
+#define CHANGE_ADD 1
+#define CHANGE_DEL 2
+
+/* a change of the set of superviseds */
+struct change
+{
+	/* generation of the set after the change */
+	uint64_t generation;
+
+	/* pid of the added or deleted supervised */
+	int pid;
+
+	/* operation CHANGE_ADD or CHANGE_DEL */
+	int op;
+};
+
+/*
+ * registry of supervised daemons
+ *
+ * Superviseds are indexed twice: by pid for the requests and
+ * by stub for the hangups. The lock is taken in read mode by
+ * lookups that are thus never serialized between them. It is
+ * taken in write mode only for linking or unlinking an item,
+ * the costly creation of the stub being made outside the lock.
+ */
+static struct {
+	/* the lock */
+	x_rwlock_t rwlock;
+
+	/* count of recorded superviseds */
+	unsigned count;
+
+	/* generation of the set of superviseds, incremented on changes */
+	uint64_t generation;
+
+	/* count of buckets, a power of 2 */
+	unsigned nbuckets;
+
+	/* buckets indexed by pid */
+	struct supervised **by_pid;
+
+	/* buckets indexed by stub */
+	struct supervised **by_stub;
+
+	/* log of the last changes indexed by generation */
+	struct change changes[CHANGES_LOG_SIZE];
+}
+	registry = { .rwlock = X_RWLOCK_INITIALIZER };
 
-/* global mutex */
-static x_mutex_t mutex = X_MUTEX_INITIALIZER;
+/* maximal count of connections accepted per wake-up */
+#define ACCEPT_BATCH_MAX 64
 
-/* list of supervised daemons */
-static struct supervised *superviseds;
+/* accepting of supervision links */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* count of wake-ups of the listener */
+	uint64_t wakeups;
+
+	/* count of connections accepted */
+	uint64_t accepted;
+
+	/* count of connections rejected or failing */
+	uint64_t rejected;
+
+	/* count of hangups of supervised daemons */
+	uint64_t hangups;
+
+	/* count of wake-ups that reached ACCEPT_BATCH_MAX */
+	uint64_t capped;
+
+	/* count of connections taken by the last wake-up, a lower bound of the backlog */
+	unsigned last_batch;
+
+	/* maximal count of connections accepted by a wake-up */
+	unsigned max_batch;
+
+	/* start in us of the current window of rate */
+	uint64_t window_us;
+
+	/* count of connections accepted in the current window */
+	unsigned window_count;
+
+	/* count of connections accepted in the previous window of 1 second */
+	unsigned rate;
+}
+	accepting = { .mutex = X_MUTEX_INITIALIZER };
+
+/* periodic discovery */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* the timer of periodic discovery */
+	struct ev_timer *timer;
+
+	/* minimal period in ms, the period of the timer */
+	unsigned min_ms;
+
+	/* maximal period in ms */
+	unsigned max_ms;
+
+	/* current period in ms */
+	unsigned period_ms;
+
+	/* elapsed time in ms since the last scan */
+	unsigned elapsed_ms;
+
+	/* was the supervised set changed since the last scan? */
+	int changed;
+
+	/* count of scans */
+	uint64_t scans;
+
+	/* count of daemons found not supervised */
+	uint64_t hits;
+
+	/* duration of the last scan in us */
+	uint64_t last_us;
+
+	/* maximal duration of scans in us */
+	uint64_t max_us;
+
+	/* cumulated duration of scans in us */
+	uint64_t total_us;
+}
+	discovery = { .mutex = X_MUTEX_INITIALIZER };
+
+/* modes of tracing of forwarded requests */
+#define TRACE_NONE      0  /* trace events not watched */
+#define TRACE_RELAYED   1  /* trace events recorded and relayed to the client */
+#define TRACE_FILTERED  2  /* trace events recorded and pushed through filters */
+
+/* the supervisor api */
+static struct afb_api_common *supervisor_api;
 
 /* events */
 static struct afb_evt *event_add_pid;
 static struct afb_evt *event_del_pid;
+static struct afb_evt *event_changed;
+static struct afb_evt *event_pids;
+static struct afb_evt *event_stalled;
+
+/* coalescing of the changes of the set of superviseds */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* duration of the coalescing window in ms, 0 for no coalescing */
+	unsigned window_ms;
+
+	/* is the timer of the window armed? */
+	int armed;
+
+	/* is 'since' kept for the next window because the last one cancelled? */
+	int carried;
+
+	/* generation before the first change of the window */
+	uint64_t since;
+
+	/* generation after the last change of the window */
+	uint64_t generation;
+
+	/* pids added and deleted during the window */
+	int *added;
+	int *deleted;
+
+	/* counts of pids added and deleted */
+	unsigned nadded;
+	unsigned ndeleted;
+
+	/* allocated counts of added and deleted */
+	unsigned szadded;
+	unsigned szdeleted;
+}
+	coalescing = { .mutex = X_MUTEX_INITIALIZER };
+
+/* notification of the changes of the set of superviseds */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* is a thread pushing the events of the changes? */
+	int draining;
+
+	/* generation of the last change notified */
+	uint64_t notified;
+}
+	notifying = { .mutex = X_MUTEX_INITIALIZER };
+
+/*************************************************************************************/
+
 
 /*************************************************************************************/
 
+/* hash of a pid */
+static inline unsigned hash_pid(int pid)
+{
+	return (unsigned)pid;
+}
+
+/* hash of a stub */
+static inline unsigned hash_stub(struct afb_stub_ws *stub)
+{
+	uintptr_t x = (uintptr_t)stub;
+	return (unsigned)((x >> 4) ^ (x >> 12));
+}
 
 /*************************************************************************************/
 
+/* cache of replies of superviseds */
+static struct {
+	/* protection of the cached replies */
+	x_mutex_t mutex;
+
+	/* time to live of the cached replies in ms, 0 for no cache */
+	unsigned ttl_ms;
+
+	/* count of replies served from the cache */
+	uint64_t hits;
+
+	/* count of replies not in the cache */
+	uint64_t misses;
+}
+	cache = { .mutex = X_MUTEX_INITIALIZER };
+
 /**
- * send on 'fd' an initiator with 'command'
- * return 0 on success or -1 on failure
+ * Get the slot of cache of the request 'verb' of 'args' or CACHE_NONE
  */
-static int send_initiator(int fd, const char *command)
+static int cache_slot(const char *verb, struct json_object *args)
 {
-	int rc;
-	ssize_t swr;
-	struct afb_supervisor_initiator asi;
+	struct json_object *item;
 
-	/* set  */
-	memset(&asi, 0, sizeof asi);
-	strcpy(asi.interface, AFB_SUPERVISOR_INTERFACE_1);
-	if (command)
-		strncpy(asi.extra, command, sizeof asi.extra - 1);
+	if (!cache.ttl_ms)
+		return CACHE_NONE;
+	if (!strcmp(verb, "config"))
+		return CACHE_CONFIG;
+	if (!strcmp(verb, "do")
+	 && json_object_object_get_ex(args, "api", &item)
+	 && !strcmp(json_object_get_string(item) ?: "", "monitor")
+	 && json_object_object_get_ex(args, "verb", &item)
+	 && !strcmp(json_object_get_string(item) ?: "", "get")
+	 && json_object_object_get_ex(args, "args", &item)
+	 && json_object_is_type(item, json_type_object)
+	 && json_object_object_length(item) == 1
+	 && json_object_object_get_ex(item, "apis", &item)
+	 && json_object_get_boolean(item))
+		return CACHE_APIS;
+	return CACHE_NONE;
+}
 
-	/* send the initiator */
-	swr = write(fd, &asi, sizeof asi);
-	if (swr < 0) {
-		rc = -errno;
-		LIBAFB_ERROR("Can't send initiator: %s", strerror(-rc));
-	} else if (swr < sizeof asi) {
-		LIBAFB_ERROR("Sending incomplete initiator!");
-		rc = X_EAGAIN;
-	} else
-		rc = 0;
-	return rc;
+/**
+ * Get in 'data' the valid cached reply of 'slot' for 's'.
+ * Returns 1 if found or 0 otherwise.
+ */
+static int cache_get(struct supervised *s, int slot, struct afb_data **data)
+{
+	struct cached *c;
+
+	x_mutex_lock(&cache.mutex);
+	c = &s->cached[slot];
+	if (c->data && c->expire_us <= afs_metrics_now()) {
+		afb_data_unref(c->data);
+		c->data = NULL;
+	}
+	*data = c->data ? afb_data_addref(c->data) : NULL;
+	if (*data)
+		cache.hits++;
+	else
+		cache.misses++;
+	x_mutex_unlock(&cache.mutex);
+	return *data != NULL;
 }
 
-#if WITH_CRED
-/*
- * checks whether the incoming supervised represented by its creds
- * is to be accepted or not.
- * return 1 if yes or 0 otherwise.
+/**
+ * Record in the 'slot' of 's' the reply 'reply'
  */
-static int should_accept(struct afb_cred *cred)
+static void cache_put(struct supervised *s, int slot, struct afb_data *reply)
 {
-	return cred && cred->pid != getpid(); /* not me! */
+	struct cached *c;
+	struct afb_data *data, *previous;
+
+	/* keep the serialized form */
+	if (afb_data_convert(reply, &afb_type_predefined_json, &data) < 0)
+		return;
+
+	x_mutex_lock(&cache.mutex);
+	c = &s->cached[slot];
+	previous = c->data;
+	c->data = data;
+	c->expire_us = afs_metrics_now() + (uint64_t)cache.ttl_ms * 1000;
+	x_mutex_unlock(&cache.mutex);
+	if (previous)
+		afb_data_unref(previous);
 }
-#endif
 
-static void on_supervised_hangup(struct afb_stub_ws *stub)
+/**
+ * Forget the cached replies of 's'
+ */
+static void cache_clear(struct supervised *s)
 {
-	struct supervised *s, **ps;
+	struct afb_data *datas[CACHE_COUNT];
+	int i;
 
-	/* Search the supervised of the ws-stub */
-	x_mutex_lock(&mutex);
-	ps = &superviseds;
-	while ((s = *ps) && s->stub != stub)
-		ps = &s->next;
+	x_mutex_lock(&cache.mutex);
+	for (i = 0 ; i < CACHE_COUNT ; i++) {
+		datas[i] = s->cached[i].data;
+		s->cached[i].data = NULL;
+	}
+	x_mutex_unlock(&cache.mutex);
+	for (i = 0 ; i < CACHE_COUNT ; i++)
+		if (datas[i])
+			afb_data_unref(datas[i]);
+}
 
-	/* unlink the supervised if found */
-	if (s)
-		*ps = s->next;
-	x_mutex_unlock(&mutex);
+/*************************************************************************************/
 
-	/* forgive the ws-stub */
-	afb_stub_ws_unref(stub);
+/**
+ * increment the reference count of 's' and return it
+ */
+static struct supervised *supervised_addref(struct supervised *s)
+{
+	if (s)
+		__atomic_add_fetch(&s->refcount, 1, __ATOMIC_RELAXED);
+	return s;
+}
 
-	/* forgive the supervised */
-	if (s) {
-		afb_json_legacy_event_push(event_del_pid, json_object_new_int((int)s->pid));
+/**
+ * decrement the reference count of 's' and release it when falling to zero
+ */
+static void supervised_unref(struct supervised *s)
+{
+	if (s && !__atomic_sub_fetch(&s->refcount, 1, __ATOMIC_ACQ_REL)) {
+		cache_clear(s);
+		if (s->tracer)
+			afb_evt_listener_unref(s->tracer);
+		afb_stub_ws_unref(s->stub);
 #if WITH_CRED
 		afb_cred_unref(s->cred);
 #endif
@@ -168,282 +496,2183 @@ static void on_supervised_hangup(struct afb_stub_ws *stub)
 	}
 }
 
-/*
- * create a supervised for socket 'fd' and 'cred'
- * return the pid > 0 in case of success or -1 in case of error
+/**
+ * Search the supervised of 'pid' in the registry that must be locked.
  */
-#if WITH_CRED
-static int make_supervised(int fd, struct afb_cred *cred)
-#else
-static int make_supervised(int fd)
-#endif
+static struct supervised *registry_search_pid_locked(int pid)
 {
 	struct supervised *s;
 
-	s = malloc(sizeof *s);
-	if (!s)
+	if (!registry.nbuckets)
+		return NULL;
+	s = registry.by_pid[hash_pid(pid) & (registry.nbuckets - 1)];
+	while (s && s->pid != pid)
+		s = s->next_pid;
+	return s;
+}
+
+/**
+ * Doubles the count of buckets of the registry that must be locked
+ * in write mode. Returns 0 on success or X_ENOMEM on failure.
+ */
+static int registry_grow_locked()
+{
+	unsigned i, n, mask;
+	struct supervised **bpid, **bstub, *s, *nxt;
+
+	n = registry.nbuckets ? registry.nbuckets << 1 : REGISTRY_INITIAL_BUCKETS;
+	bpid = calloc(n, sizeof *bpid);
+	bstub = calloc(n, sizeof *bstub);
+	if (!bpid || !bstub) {
+		free(bpid);
+		free(bstub);
 		return X_ENOMEM;
+	}
 
-	s->stub = afb_stub_ws_create_client(fd, 1, supervision_apiname, empty_apiset);
-	if (!s->stub) {
-		free(s);
-		return -1;
+	mask = n - 1;
+	for (i = 0 ; i < registry.nbuckets ; i++) {
+		for (s = registry.by_pid[i] ; s ; s = nxt) {
+			nxt = s->next_pid;
+			s->next_pid = bpid[hash_pid(s->pid) & mask];
+			bpid[hash_pid(s->pid) & mask] = s;
+		}
+		for (s = registry.by_stub[i] ; s ; s = nxt) {
+			nxt = s->next_stub;
+			s->next_stub = bstub[hash_stub(s->stub) & mask];
+			bstub[hash_stub(s->stub) & mask] = s;
+		}
 	}
-	x_mutex_lock(&mutex);
-#if WITH_CRED
-	s->cred = cred;
-	s->pid = (int)cred->pid;
-#else
-	{
-		static int x = 0;
+	free(registry.by_pid);
+	free(registry.by_stub);
+	registry.by_pid = bpid;
+	registry.by_stub = bstub;
+	registry.nbuckets = n;
+	return 0;
+}
 
-		struct supervised *i;
-		do {
-			if (++x < 0)
-				x = 1;
-			i = superviseds;
-			while (i && i->pid != x)
-				i = i->next;
-		} while (i);
-		s->pid = x;
+/**
+ * Ensures that the registry has room for one more supervised.
+ * Returns 0 on success or X_ENOMEM on failure.
+ */
+static int registry_reserve()
+{
+	int rc;
+
+	x_rwlock_wrlock(&registry.rwlock);
+	rc = registry.count < registry.nbuckets ? 0 : registry_grow_locked();
+	if (rc < 0 && registry.nbuckets)
+		rc = 0; /* still works but with longer chains */
+	x_rwlock_unlock(&registry.rwlock);
+	return rc;
+}
+
+/**
+ * Makes the json object describing the 'change'
+ */
+static struct json_object *change_json(const struct change *change)
+{
+	struct json_object *obj;
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "generation", json_object_new_int64((int64_t)change->generation));
+	json_object_object_add(obj, "op", json_object_new_string(change->op == CHANGE_ADD ? "add" : "del"));
+	json_object_object_add(obj, "pid", json_object_new_int(change->pid));
+	return obj;
+}
+
+/**
+ * Makes a json array of the 'count' 'pids'
+ */
+static struct json_object *pids_json(const int *pids, unsigned count)
+{
+	struct json_object *array;
+	unsigned i;
+
+	array = json_object_new_array();
+	for (i = 0 ; i < count ; i++)
+		json_object_array_add(array, json_object_new_int(pids[i]));
+	return array;
+}
+
+/**
+ * Takes the changes of the coalescing window and returns the object of
+ * the event pids giving them or NULL when they cancelled each other, in
+ * which case the generation 'since' is carried to the next window.
+ * coalescing.mutex held.
+ */
+static struct json_object *coalescing_take_locked()
+{
+	struct json_object *obj;
+
+	if (!coalescing.nadded && !coalescing.ndeleted) {
+		coalescing.carried = 1;
+		return NULL;
 	}
-#endif
-	s->next = superviseds;
-	superviseds = s;
-	x_mutex_unlock(&mutex);
-	afb_stub_ws_set_on_hangup(s->stub, on_supervised_hangup);
-	return s->pid;
+	obj = json_object_new_object();
+	json_object_object_add(obj, "generation", json_object_new_int64((int64_t)coalescing.generation));
+	json_object_object_add(obj, "since", json_object_new_int64((int64_t)coalescing.since));
+	json_object_object_add(obj, "add", pids_json(coalescing.added, coalescing.nadded));
+	json_object_object_add(obj, "del", pids_json(coalescing.deleted, coalescing.ndeleted));
+	coalescing.nadded = coalescing.ndeleted = 0;
+	coalescing.carried = 0;
+	return obj;
+}
+
+/**
+ * Pushes the changes of the coalescing window and resets it
+ */
+static void coalescing_flush(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	struct json_object *obj;
+
+	x_mutex_lock(&coalescing.mutex);
+	obj = coalescing_take_locked();
+	coalescing.armed = 0;
+	x_mutex_unlock(&coalescing.mutex);
+	if (obj)
+		afb_json_legacy_event_push(event_pids, obj);
+}
+
+/**
+ * Adds 'pid' to the 'pids' of 'count' allocated for 'size'
+ * Returns 0 on success or X_ENOMEM.
+ */
+static int pids_add(int **pids, unsigned *count, unsigned *size, int pid)
+{
+	int *array;
+	unsigned sz;
+
+	if (*count == *size) {
+		sz = *size ? *size << 1 : 64;
+		array = realloc(*pids, sz * sizeof *array);
+		if (!array)
+			return X_ENOMEM;
+		*pids = array;
+		*size = sz;
+	}
+	(*pids)[(*count)++] = pid;
+	return 0;
+}
+
+/**
+ * Removes 'pid' from the 'pids' of 'count'
+ * Returns 1 if removed or 0 if not found.
+ */
+static int pids_remove(int *pids, unsigned *count, int pid)
+{
+	unsigned i;
+
+	for (i = 0 ; i < *count ; i++) {
+		if (pids[i] == pid) {
+			pids[i] = pids[--*count];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Records the change 'op' of 'pid' of 'generation' in the window of
+ * coalescing, an addition and a deletion of the same pid cancelling.
+ * Returns 0 on success or a negative error code when the change has
+ * to be notified immediately, the changes of the window being then
+ * pushed before.
+ */
+static int coalesce(int op, int pid, uint64_t generation)
+{
+	struct ev_timer *timer;
+	struct json_object *obj;
+	int rc;
+
+	obj = NULL;
+	x_mutex_lock(&coalescing.mutex);
+	if (!coalescing.armed) {
+		rc = afb_ev_mgr_add_timer(&timer, 0,
+				(time_t)(coalescing.window_ms / 1000), coalescing.window_ms % 1000,
+				1, 0, coalescing.window_ms / 10 ?: 1, coalescing_flush, NULL, 1);
+		if (rc < 0)
+			goto end;
+		coalescing.armed = 1;
+		if (!coalescing.carried)
+			coalescing.since = generation - 1;
+		coalescing.carried = 0;
+	}
+	rc = 0;
+	if (op == CHANGE_ADD) {
+		if (!pids_remove(coalescing.deleted, &coalescing.ndeleted, pid))
+			rc = pids_add(&coalescing.added, &coalescing.nadded, &coalescing.szadded, pid);
+	}
+	else {
+		if (!pids_remove(coalescing.added, &coalescing.nadded, pid))
+			rc = pids_add(&coalescing.deleted, &coalescing.ndeleted, &coalescing.szdeleted, pid);
+	}
+	if (rc >= 0)
+		coalescing.generation = generation;
+	else {
+		/* keep the order: the window goes first, the rest of it follows */
+		obj = coalescing_take_locked();
+		coalescing.carried = 0;
+		coalescing.since = coalescing.generation = generation;
+	}
+end:
+	x_mutex_unlock(&coalescing.mutex);
+	if (obj)
+		afb_json_legacy_event_push(event_pids, obj);
+	return rc;
+}
+
+/**
+ * Records in the registry locked in write mode the change 'op' of 'pid'.
+ * The log of changes is the queue of the notifications: they are pushed
+ * by registry_notify after the release of the lock.
+ */
+static void registry_changed_locked(int op, int pid)
+{
+	struct change *change;
+
+	registry.generation++;
+	change = &registry.changes[registry.generation & (CHANGES_LOG_SIZE - 1)];
+	change->generation = registry.generation;
+	change->pid = pid;
+	change->op = op;
+}
+
+/**
+ * Pushes the events of the changes of the registry not yet notified,
+ * in the order of their generations. To be called without the registry
+ * lock after a change. A single thread pushes at a time, the others
+ * leaving it their changes.
+ */
+static void registry_notify()
+{
+	struct change change;
+	uint64_t generation, lost;
+
+	x_mutex_lock(&notifying.mutex);
+	if (notifying.draining) {
+		x_mutex_unlock(&notifying.mutex);
+		return;
+	}
+	notifying.draining = 1;
+	for (;;) {
+		lost = 0;
+		x_rwlock_rdlock(&registry.rwlock);
+		generation = registry.generation;
+		if (generation - notifying.notified > CHANGES_LOG_SIZE) {
+			lost = generation - notifying.notified - CHANGES_LOG_SIZE;
+			notifying.notified += lost;
+		}
+		if (notifying.notified < generation)
+			change = registry.changes[(notifying.notified + 1) & (CHANGES_LOG_SIZE - 1)];
+		x_rwlock_unlock(&registry.rwlock);
+		if (lost)
+			LIBAFB_WARNING("%llu changes of the superviseds not notified", (unsigned long long)lost);
+		if (notifying.notified == generation)
+			break;
+		notifying.notified = change.generation;
+		x_mutex_unlock(&notifying.mutex);
+
+		if (!coalescing.window_ms || coalesce(change.op, change.pid, change.generation) < 0) {
+			afb_json_legacy_event_push(change.op == CHANGE_ADD ? event_add_pid : event_del_pid,
+							json_object_new_int(change.pid));
+			afb_json_legacy_event_push(event_changed, change_json(&change));
+		}
+
+		x_mutex_lock(&notifying.mutex);
+	}
+	notifying.draining = 0;
+	x_mutex_unlock(&notifying.mutex);
+}
+
+/**
+ * Links the supervised 's' in the registry that must be locked
+ * in write mode and have buckets (see registry_reserve).
+ */
+static void registry_link_locked(struct supervised *s)
+{
+	unsigned ip, is;
+
+	ip = hash_pid(s->pid) & (registry.nbuckets - 1);
+	is = hash_stub(s->stub) & (registry.nbuckets - 1);
+	s->next_pid = registry.by_pid[ip];
+	registry.by_pid[ip] = s;
+	s->next_stub = registry.by_stub[is];
+	registry.by_stub[is] = s;
+	registry.count++;
+	registry_changed_locked(CHANGE_ADD, s->pid);
+}
+
+/**
+ * Unlinks from the registry the supervised of 'stub' and returns it
+ * or NULL if not found. The reference of the registry is transfered
+ * to the caller.
+ */
+static struct supervised *registry_unlink_stub(struct afb_stub_ws *stub)
+{
+	struct supervised *s, **ps;
+
+	x_rwlock_wrlock(&registry.rwlock);
+	s = NULL;
+	if (registry.nbuckets) {
+		ps = &registry.by_stub[hash_stub(stub) & (registry.nbuckets - 1)];
+		while ((s = *ps) && s->stub != stub)
+			ps = &s->next_stub;
+		if (s) {
+			*ps = s->next_stub;
+			ps = &registry.by_pid[hash_pid(s->pid) & (registry.nbuckets - 1)];
+			while (*ps != s)
+				ps = &(*ps)->next_pid;
+			*ps = s->next_pid;
+			registry.count--;
+			registry_changed_locked(CHANGE_DEL, s->pid);
+		}
+	}
+	x_rwlock_unlock(&registry.rwlock);
+	if (s)
+		registry_notify();
+	return s;
+}
+
+/**
+ * Search the supervised of 'pid', return it or NULL.
+ * The returned supervised has to be released using supervised_unref.
+ */
+static struct supervised *supervised_of_pid(int pid)
+{
+	struct supervised *s;
+
+	x_rwlock_rdlock(&registry.rwlock);
+	s = supervised_addref(registry_search_pid_locked(pid));
+	x_rwlock_unlock(&registry.rwlock);
+
+	return s;
+}
+
+/**
+ * Call 'callback' for each recorded supervised while holding
+ * the registry lock in read mode. Returns the generation of
+ * the enumerated set.
+ */
+static uint64_t supervised_for_all(void (*callback)(void *closure, struct supervised *s), void *closure)
+{
+	unsigned i;
+	uint64_t generation;
+	struct supervised *s;
+
+	x_rwlock_rdlock(&registry.rwlock);
+	generation = registry.generation;
+	for (i = 0 ; i < registry.nbuckets ; i++)
+		for (s = registry.by_pid[i] ; s ; s = s->next_pid)
+			callback(closure, s);
+	x_rwlock_unlock(&registry.rwlock);
+	return generation;
+}
+
+/**
+ * Get the current generation of the set of superviseds
+ */
+static uint64_t registry_generation()
+{
+	uint64_t generation;
+
+	x_rwlock_rdlock(&registry.rwlock);
+	generation = registry.generation;
+	x_rwlock_unlock(&registry.rwlock);
+	return generation;
+}
+
+/*************************************************************************************/
+
+/**
+ * get the current monotonic time in microseconds
+ */
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * records that the set of superviseds changed, tightening
+ * the period of the discovery
+ */
+static void discovery_changed()
+{
+	x_mutex_lock(&discovery.mutex);
+	discovery.changed = 1;
+	discovery.period_ms = discovery.min_ms;
+	x_mutex_unlock(&discovery.mutex);
+}
+
+/*************************************************************************************/
+
+/**
+ * send on 'fd' an initiator with 'command'
+ * return 0 on success or -1 on failure
+ */
+static int send_initiator(int fd, const char *command)
+{
+	int rc;
+	ssize_t swr;
+	struct afb_supervisor_initiator asi;
+
+	/* set  */
+	memset(&asi, 0, sizeof asi);
+	strcpy(asi.interface, AFB_SUPERVISOR_INTERFACE_1);
+	if (command)
+		strncpy(asi.extra, command, sizeof asi.extra - 1);
+
+	/* send the initiator */
+	swr = write(fd, &asi, sizeof asi);
+	if (swr < 0) {
+		rc = -errno;
+		LIBAFB_ERROR("Can't send initiator: %s", strerror(-rc));
+	} else if (swr < sizeof asi) {
+		LIBAFB_ERROR("Sending incomplete initiator!");
+		rc = X_EAGAIN;
+	} else
+		rc = 0;
+	return rc;
+}
+
+#if WITH_CRED
+/*
+ * checks whether the incoming supervised represented by its creds
+ * is to be accepted or not.
+ * return 1 if yes or 0 otherwise.
+ */
+static int should_accept(struct afb_cred *cred)
+{
+	return cred && cred->pid != getpid(); /* not me! */
+}
+#endif
+
+static void on_supervised_hangup(struct afb_stub_ws *stub)
+{
+	struct supervised *s;
+
+	/* Search and unlink the supervised of the ws-stub */
+	s = registry_unlink_stub(stub);
+	if (!s) {
+		/* forgive the ws-stub */
+		afb_stub_ws_unref(stub);
+		return;
+	}
+
+	x_mutex_lock(&accepting.mutex);
+	accepting.hangups++;
+	x_mutex_unlock(&accepting.mutex);
+
+	/* forgive the supervised */
+	cache_clear(s);
+#if WITH_CRED
+	afs_snapshot_del((pid_t)s->pid);
+#endif
+	afs_metrics_forget((int)s->pid);
+	afs_sessions_forget((int)s->pid);
+	afs_health_forget((int)s->pid);
+	discovery_changed();
+	supervised_unref(s);
+}
+
+/*
+ * dispatch the trace event 'event' of the supervised 'closure'
+ */
+static void tracer_push(void *closure, const struct afb_evt_pushed *event)
+{
+	afs_trace_dispatch((int)(intptr_t)closure, event->data.nparams, event->data.params);
+}
+
+static void tracer_broadcast(void *closure, const struct afb_evt_broadcasted *event)
+{
+}
+
+static void tracer_add(void *closure, const char *event, uint16_t evtid)
+{
+}
+
+static void tracer_remove(void *closure, const char *event, uint16_t evtid)
+{
+}
+
+/* interface of the listeners of trace events */
+static const struct afb_evt_itf tracer_itf =
+{
+	.push = tracer_push,
+	.broadcast = tracer_broadcast,
+	.add = tracer_add,
+	.remove = tracer_remove
+};
+
+/*
+ * create a supervised for socket 'fd' and 'cred'
+ * return the pid > 0 in case of success or -1 in case of error
+ */
+#if WITH_CRED
+static int make_supervised(int fd, struct afb_cred *cred)
+#else
+static int make_supervised(int fd)
+#endif
+{
+	struct supervised *s;
+
+	if (registry_reserve() < 0)
+		return X_ENOMEM;
+
+	s = malloc(sizeof *s);
+	if (!s)
+		return X_ENOMEM;
+
+	s->stub = afb_stub_ws_create_client(fd, 1, supervision_apiname, empty_apiset);
+	if (!s->stub) {
+		free(s);
+		return -1;
+	}
+	s->refcount = 1;
+	s->fd = fd;
+	memset(s->cached, 0, sizeof s->cached);
+	x_rwlock_wrlock(&registry.rwlock);
+#if WITH_CRED
+	s->cred = cred;
+	s->pid = (int)cred->pid;
+#else
+	{
+		static int x = 0;
+
+		do {
+			if (++x < 0)
+				x = 1;
+		} while (registry_search_pid_locked(x));
+		s->pid = x;
+	}
+#endif
+	s->tracer = afb_evt_listener_create(&tracer_itf, (void*)(intptr_t)s->pid, NULL);
+	registry_link_locked(s);
+	x_rwlock_unlock(&registry.rwlock);
+	registry_notify();
+	afb_stub_ws_set_on_hangup(s->stub, on_supervised_hangup);
+	afs_sessions_track(s->pid);
+	afs_health_track(s->pid, afs_metrics_now());
+#if WITH_CRED
+	afs_snapshot_add((pid_t)s->pid, s->cred->uid, s->cred->gid);
+#endif
+	return s->pid;
+}
+
+/*
+ * handles the incoming connection 'fd'
+ * return 1 if accepted or 0 otherwise
+ */
+static int accept_supervision_link(int fd)
+{
+	int rc;
+#if WITH_CRED
+	struct afb_cred *cred;
+
+	afb_cred_create_for_socket(&cred, fd);
+	rc = should_accept(cred);
+	if (rc) {
+#endif
+		rc = send_initiator(fd, NULL);
+		if (!rc) {
+#if WITH_CRED
+			rc = make_supervised(fd, cred);
+#else
+			rc = make_supervised(fd);
+#endif
+			if (rc > 0) {
+				afs_wakeup_connected((pid_t)rc);
+				discovery_changed();
+				return 1;
+			}
+		}
+#if WITH_CRED
+	}
+	afb_cred_unref(cred);
+#endif
+	close(fd);
+	return 0;
+}
+
+/*
+ * handles the incoming connections pending on 'sock'
+ * at most ACCEPT_BATCH_MAX are accepted for being fair with other events
+ */
+static void accept_supervision_links(int sock)
+{
+	int fd;
+	unsigned accepted, rejected, n;
+	uint64_t now;
+	struct sockaddr_un addr;
+	socklen_t lenaddr;
+
+	accepted = rejected = 0;
+	for (n = 0 ; n < ACCEPT_BATCH_MAX ; n++) {
+		lenaddr = (socklen_t)sizeof addr;
+		fd = accept4(sock, (struct sockaddr*)&addr, &lenaddr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LIBAFB_ERROR("can't accept supervision link: %s", strerror(errno));
+			break;
+		}
+		if (accept_supervision_link(fd))
+			accepted++;
+		else
+			rejected++;
+	}
+
+	/* update the counters */
+	now = now_us();
+	x_mutex_lock(&accepting.mutex);
+	accepting.wakeups++;
+	accepting.accepted += accepted;
+	accepting.rejected += rejected;
+	accepting.last_batch = accepted + rejected;
+	if (accepting.last_batch > accepting.max_batch)
+		accepting.max_batch = accepting.last_batch;
+	if (n == ACCEPT_BATCH_MAX)
+		accepting.capped++;
+	if (now - accepting.window_us >= 1000000) {
+		accepting.rate = now - accepting.window_us >= 2000000 ? 0 : accepting.window_count;
+		accepting.window_us = now;
+		accepting.window_count = 0;
+	}
+	accepting.window_count += accepted;
+	x_mutex_unlock(&accepting.mutex);
+}
+
+/*
+ * handle even on server socket
+ */
+static void listening(struct ev_fd *efd, int fd, uint32_t revents, void *closure)
+{
+	if ((revents & EV_FD_HUP) != 0) {
+		LIBAFB_ERROR("supervision socket closed");
+		exit(1);
+	}
+	if ((revents & EV_FD_IN) != 0)
+		accept_supervision_links(fd);
+}
+
+/*
+ */
+static void discovered_cb(void *closure, pid_t pid)
+{
+	struct supervised *s;
+
+	s = supervised_of_pid(pid);
+	if (!s && afs_discover_check(pid, daemon_pattern)) {
+		(*(int*)closure)++;
+		afs_wakeup_request(pid);
+	}
+	supervised_unref(s);
+}
+
+/*
+ * check if 'pid' is supervised
+ */
+static int is_supervised(pid_t pid)
+{
+	struct supervised *s;
+
+	s = supervised_of_pid(pid);
+	supervised_unref(s);
+	return s != NULL;
+}
+
+/*
+ * check if 'pid' is still a daemon
+ */
+static int is_daemon(pid_t pid)
+{
+	return afs_discover_check(pid, daemon_pattern);
+}
+
+int afs_supervisor_discover()
+{
+	int n = 0;
+	uint64_t start, duration;
+
+	start = now_us();
+	afs_discover(daemon_pattern, discovered_cb, &n);
+	duration = now_us() - start;
+
+	x_mutex_lock(&discovery.mutex);
+	discovery.scans++;
+	discovery.hits += (unsigned)n;
+	discovery.last_us = duration;
+	discovery.total_us += duration;
+	if (duration > discovery.max_us)
+		discovery.max_us = duration;
+	x_mutex_unlock(&discovery.mutex);
+	return n;
+}
+
+/*
+ * discovery deferred by afs_supervisor_discover_later
+ */
+static void discover_later_cb(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	afs_supervisor_discover();
+}
+
+int afs_supervisor_discover_later(unsigned delay_ms)
+{
+	struct ev_timer *timer;
+
+	return afb_ev_mgr_add_timer(&timer, 0,
+			(time_t)(delay_ms / 1000), delay_ms % 1000,
+			1, 0, delay_ms / 10 ?: 1, discover_later_cb, NULL, 1);
+}
+
+/*
+ * wake up the daemon 'pid' of the snapshot of the previous instance
+ */
+static void warm_wakeup(void *closure, pid_t pid)
+{
+	struct supervised *s;
+
+	s = supervised_of_pid(pid);
+	if (!s && afs_discover_check(pid, daemon_pattern))
+		afs_wakeup_request(pid);
+	supervised_unref(s);
+}
+
+#if WITH_CRED
+/*
+ * record in the new snapshot the supervised 's' handed off
+ */
+static void warm_record(void *closure, struct supervised *s)
+{
+	afs_snapshot_add((pid_t)s->pid, s->cred->uid, s->cred->gid);
+}
+#endif
+
+int afs_supervisor_warm_start(const char *path)
+{
+	int rc;
+
+	rc = afs_snapshot_open(path, warm_wakeup, NULL);
+#if WITH_CRED
+	if (rc >= 0)
+		supervised_for_all(warm_record, NULL);
+#endif
+	return rc;
+}
+
+/* delay in ms letting the reply of handoff go before the exec */
+#define HANDOFF_DELAY_MS 100
+
+/* count of delays waiting the forwarded requests before giving up */
+#define HANDOFF_RETRIES 50
+
+/*
+ * hand off the listening socket to a new exec of the supervisor
+ * the closure counts the delays already waited
+ *
+ * The supervised connections are not handed off: the stubs of the
+ * connections can't be stopped between two frames and the new stubs
+ * would restart their ids of sessions and events. They are closed by
+ * the exec (SOCK_CLOEXEC) and the new instance wakes up the daemons
+ * of the snapshot then discovers the others, making them connect again.
+ */
+static void handoff_cb(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	unsigned retries = (unsigned)(intptr_t)closure;
+	int rc, fd;
+	const char *name;
+
+	/* requests forwarded since the reply would be lost: wait them */
+	if (afs_metrics_inflight()) {
+		if (retries >= HANDOFF_RETRIES)
+			LIBAFB_ERROR("handoff aborted: requests still forwarded");
+		else if (afb_ev_mgr_add_timer(&timer, 0, 0, HANDOFF_DELAY_MS, 1, 0, 1,
+						handoff_cb, (void*)(intptr_t)(retries + 1), 1) < 0)
+			LIBAFB_ERROR("handoff aborted: can't wait the forwarded requests");
+		return;
+	}
+
+	fd = supervision_fd;
+	name = AFS_HANDOFF_LISTENER;
+	rc = afs_handoff_exec(1, &fd, &name);
+	LIBAFB_ERROR("can't hand off the supervision: %s", strerror(-rc));
+}
+
+/*
+ * tick of the periodic discovery
+ */
+static void discovery_tick(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	int n, due;
+
+	/* is a scan due? */
+	x_mutex_lock(&discovery.mutex);
+	discovery.elapsed_ms += discovery.min_ms;
+	due = discovery.elapsed_ms >= discovery.period_ms;
+	x_mutex_unlock(&discovery.mutex);
+	if (!due)
+		return;
+
+	n = afs_supervisor_discover();
+
+	/* adapt the period: back off when nothing happens */
+	x_mutex_lock(&discovery.mutex);
+	discovery.elapsed_ms = 0;
+	if (n || discovery.changed)
+		discovery.period_ms = discovery.min_ms;
+	else if (discovery.period_ms < discovery.max_ms)
+		discovery.period_ms = discovery.period_ms > discovery.max_ms / 2
+					? discovery.max_ms : discovery.period_ms << 1;
+	discovery.changed = 0;
+	x_mutex_unlock(&discovery.mutex);
+}
+
+int afs_supervisor_pace_wakeups(unsigned rate, unsigned batch, unsigned timeout_ms, unsigned retries)
+{
+	return afs_wakeup_start(rate, batch, timeout_ms, retries, is_supervised, is_daemon);
+}
+
+int afs_supervisor_auto_discover(unsigned min_ms, unsigned max_ms)
+{
+	int rc;
+
+	if (discovery.timer || !min_ms)
+		return 0;
+
+	discovery.min_ms = min_ms;
+	discovery.max_ms = max_ms > min_ms ? max_ms : min_ms;
+	discovery.period_ms = min_ms;
+	rc = afb_ev_mgr_add_timer(&discovery.timer, 0,
+			(time_t)(min_ms / 1000), min_ms % 1000,
+			0, min_ms, min_ms / 10 ?: 1, discovery_tick, NULL, 0);
+	if (rc < 0)
+		discovery.timer = NULL;
+	return rc;
+}
+
+/*
+ * a daemon watched starting had time to connect by itself
+ */
+static void watched_wakeup(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	pid_t pid = (pid_t)(intptr_t)closure;
+	struct supervised *s;
+
+	s = supervised_of_pid(pid);
+	if (!s && afs_discover_check(pid, daemon_pattern))
+		afs_wakeup_request(pid);
+	supervised_unref(s);
+}
+
+/*
+ * a process executed a new program
+ */
+static void watched_exec(void *closure, pid_t pid)
+{
+	struct ev_timer *timer;
+
+	/* daemons try to connect by themselves when starting, wait a little */
+	if (afs_discover_check(pid, daemon_pattern))
+		afb_ev_mgr_add_timer(&timer, 0,
+			WATCH_WAKEUP_DELAY_MS / 1000, WATCH_WAKEUP_DELAY_MS % 1000,
+			1, 0, 100, watched_wakeup, (void*)(intptr_t)pid, 1);
+}
+
+/*
+ * handle events of the proc connector
+ */
+static void watching(struct ev_fd *efd, int fd, uint32_t revents, void *closure)
+{
+	int rc;
+
+	rc = afs_discover_watch_read(fd, watched_exec, NULL);
+	if (rc == -ENOBUFS) {
+		LIBAFB_WARNING("process events lost, scanning processes");
+		afs_supervisor_discover();
+	}
+	else if (rc < 0)
+		LIBAFB_ERROR("error while reading process events: %s", strerror(-rc));
+}
+
+int afs_supervisor_watch()
+{
+	int rc, fd;
+
+	rc = 0;
+	if (!watch_efd) {
+		rc = afs_discover_watch_open();
+		if (rc >= 0) {
+			fd = rc;
+			rc = afb_ev_mgr_add_fd(&watch_efd, fd, EV_FD_IN, watching, 0, 0, 1);
+			if (rc < 0)
+				close(fd);
+		}
+	}
+	return rc;
+}
+
+/*************************************************************************************/
+
+/* the serialized reply to list */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* generation of the set of the reply */
+	uint64_t generation;
+
+	/* the serialized reply or NULL */
+	struct afb_data *data;
+}
+	listing = { .mutex = X_MUTEX_INITIALIZER };
+
+static void list_add(void *closure, struct supervised *s)
+{
+	char pid[50];
+	struct json_object *resu = closure, *item;
+
+	sprintf(pid, "%d", (int)s->pid);
+	item = NULL;
+#if WITH_CRED
+	item = json_object_new_object();
+	json_object_object_add(item, "pid", json_object_new_int((int)s->cred->pid));
+	json_object_object_add(item, "uid", json_object_new_int((int)s->cred->uid));
+	json_object_object_add(item, "gid", json_object_new_int((int)s->cred->gid));
+	json_object_object_add(item, "id", json_object_new_string(s->cred->id));
+	json_object_object_add(item, "label", json_object_new_string(s->cred->label));
+	json_object_object_add(item, "user", json_object_new_string(s->cred->user));
+#endif
+	json_object_object_add(resu, pid, item);
+}
+
+/**
+ * Rebuilds the serialized reply to list if the set of superviseds changed
+ * and returns a new reference to it or NULL on error. listing.mutex held.
+ */
+static struct afb_data *list_get_locked()
+{
+	struct json_object *resu;
+	struct afb_data *data, *serialized;
+	uint64_t generation;
+
+	if (!listing.data || listing.generation != registry_generation()) {
+		resu = json_object_new_object();
+		generation = supervised_for_all(list_add, resu);
+		if (afb_json_legacy_make_data_json_c(&data, resu) < 0)
+			return NULL;
+		if (afb_data_convert(data, &afb_type_predefined_json, &serialized) < 0)
+			serialized = NULL;
+		afb_data_unref(data);
+		if (!serialized)
+			return NULL;
+		if (listing.data)
+			afb_data_unref(listing.data);
+		listing.data = serialized;
+		listing.generation = generation;
+	}
+	return afb_data_addref(listing.data);
+}
+
+static void f_list(struct afb_req_common *req, struct json_object *args)
+{
+	struct json_object *resu, *item;
+	struct afb_data *data;
+
+	if (afs_federation_route(req, args))
+		return;
+
+	/* the daemons of the children are added on demand, without caching */
+	if (json_object_object_get_ex(args, "subtree", &item) && json_object_get_boolean(item)) {
+		resu = json_object_new_object();
+		supervised_for_all(list_add, resu);
+		afs_federation_list(resu);
+		afb_json_legacy_req_reply_hookable(req, resu, NULL, NULL);
+		return;
+	}
+
+	x_mutex_lock(&listing.mutex);
+	data = list_get_locked();
+	x_mutex_unlock(&listing.mutex);
+	if (data)
+		afb_req_common_reply_hookable(req, 0, 1, &data);
+	else
+		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+}
+
+/**
+ * Returns a new object with the current "generation" of the set of
+ * superviseds and its "list" (as returned by list)
+ */
+static struct json_object *snapshot()
+{
+	struct json_object *resu, *list;
+	uint64_t generation;
+
+	list = json_object_new_object();
+	generation = supervised_for_all(list_add, list);
+	resu = json_object_new_object();
+	json_object_object_add(resu, "generation", json_object_new_int64((int64_t)generation));
+	json_object_object_add(resu, "list", list);
+	return resu;
+}
+
+static void f_subscribe(struct afb_req_common *req, struct json_object *args)
+{
+	struct json_object *item;
+	int revoke, changes, ok;
+
+	revoke = json_object_is_type(args, json_type_boolean)
+		&& !json_object_get_boolean(args);
+	changes = json_object_object_get_ex(args, "changes", &item)
+		&& json_object_get_boolean(item);
+
+	ok = 1;
+	if (!revoke) {
+		if (changes)
+			ok = !afb_req_common_subscribe(req, event_changed);
+		else
+			ok = !afb_req_common_subscribe(req, event_add_pid)
+				&& !afb_req_common_subscribe(req, event_del_pid);
+		ok = ok && !afb_req_common_subscribe(req, event_pids)
+			&& !afb_req_common_subscribe(req, event_stalled);
+	}
+	if (revoke || !ok) {
+		afb_req_common_unsubscribe(req, event_add_pid);
+		afb_req_common_unsubscribe(req, event_del_pid);
+		afb_req_common_unsubscribe(req, event_changed);
+		afb_req_common_unsubscribe(req, event_pids);
+		afb_req_common_unsubscribe(req, event_stalled);
+	}
+
+	/* the snapshot is taken after subscribing for not missing changes */
+	afb_json_legacy_req_reply_hookable(req, ok && !revoke ? snapshot() : NULL, ok ? NULL : "error", NULL);
+}
+
+static void f_changes_since(struct afb_req_common *req, struct json_object *args)
+{
+	struct json_object *resu, *array, *item;
+	uint64_t since, generation;
+
+	if (!json_object_object_get_ex(args, "generation", &item)
+	 || json_object_get_int64(item) < 0) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "invalid-request", NULL);
+		return;
+	}
+	since = (uint64_t)json_object_get_int64(item);
+
+	x_rwlock_rdlock(&registry.rwlock);
+	generation = registry.generation;
+	if (since > generation || generation - since > CHANGES_LOG_SIZE)
+		resu = NULL;
+	else {
+		array = json_object_new_array();
+		while (since < generation)
+			json_object_array_add(array,
+				change_json(&registry.changes[++since & (CHANGES_LOG_SIZE - 1)]));
+		resu = json_object_new_object();
+		json_object_object_add(resu, "generation", json_object_new_int64((int64_t)generation));
+		json_object_object_add(resu, "changes", array);
+	}
+	x_rwlock_unlock(&registry.rwlock);
+
+	/* too old or unknown: resynchronize with a snapshot */
+	if (!resu) {
+		resu = snapshot();
+		json_object_object_add(resu, "reset", json_object_new_boolean(1));
+	}
+	afb_json_legacy_req_reply_hookable(req, resu, NULL, NULL);
+}
+
+/**
+ * add the counters of discovery to 'resu'
+ */
+static void add_discovery_counters(struct json_object *resu)
+{
+	struct json_object *item;
+	struct afs_wakeup_stats wstats;
+
+	x_mutex_lock(&discovery.mutex);
+	json_object_object_add(resu, "scans", json_object_new_int64((int64_t)discovery.scans));
+	json_object_object_add(resu, "hits", json_object_new_int64((int64_t)discovery.hits));
+	json_object_object_add(resu, "last-scan-us", json_object_new_int64((int64_t)discovery.last_us));
+	json_object_object_add(resu, "max-scan-us", json_object_new_int64((int64_t)discovery.max_us));
+	json_object_object_add(resu, "total-scan-us", json_object_new_int64((int64_t)discovery.total_us));
+	json_object_object_add(resu, "period-ms", json_object_new_int64(discovery.timer ? (int64_t)discovery.period_ms : 0));
+	x_mutex_unlock(&discovery.mutex);
+
+	afs_wakeup_get_stats(&wstats);
+	item = json_object_new_object();
+	json_object_object_add(item, "queued", json_object_new_int64((int64_t)wstats.queued));
+	json_object_object_add(item, "signaled", json_object_new_int64((int64_t)wstats.signaled));
+	json_object_object_add(item, "retried", json_object_new_int64((int64_t)wstats.retried));
+	json_object_object_add(item, "connected", json_object_new_int64((int64_t)wstats.connected));
+	json_object_object_add(item, "abandoned", json_object_new_int64((int64_t)wstats.abandoned));
+	json_object_object_add(item, "pending", json_object_new_int64(wstats.pending));
+	json_object_object_add(item, "waiting", json_object_new_int64(wstats.waiting));
+	json_object_object_add(resu, "wakeup", item);
+}
+
+/**
+ * add the counters of accepting to 'resu'
+ */
+static void add_accept_counters(struct json_object *resu)
+{
+	x_mutex_lock(&accepting.mutex);
+	json_object_object_add(resu, "wakeups", json_object_new_int64((int64_t)accepting.wakeups));
+	json_object_object_add(resu, "accepted", json_object_new_int64((int64_t)accepting.accepted));
+	json_object_object_add(resu, "rejected", json_object_new_int64((int64_t)accepting.rejected));
+	json_object_object_add(resu, "hangups", json_object_new_int64((int64_t)accepting.hangups));
+	json_object_object_add(resu, "capped", json_object_new_int64((int64_t)accepting.capped));
+	json_object_object_add(resu, "last-batch", json_object_new_int64(accepting.last_batch));
+	json_object_object_add(resu, "max-batch", json_object_new_int64(accepting.max_batch));
+	json_object_object_add(resu, "rate", json_object_new_int64(accepting.rate));
+	x_mutex_unlock(&accepting.mutex);
+}
+
+static void f_discover(struct afb_req_common *req, struct json_object *args)
+{
+	int n;
+	struct json_object *resu;
+
+	n = afs_supervisor_discover();
+
+	resu = json_object_new_object();
+	json_object_object_add(resu, "signaled", json_object_new_int(n));
+	add_discovery_counters(resu);
+	afb_json_legacy_req_reply_hookable(req, resu, NULL, NULL);
+}
+
+static void f_counters(struct afb_req_common *req, struct json_object *args)
+{
+	struct json_object *resu, *item;
+
+	if (afs_federation_route(req, args))
+		return;
+
+	resu = json_object_new_object();
+	item = json_object_new_object();
+	add_discovery_counters(item);
+	json_object_object_add(resu, "discovery", item);
+	item = json_object_new_object();
+	add_accept_counters(item);
+	json_object_object_add(resu, "accept", item);
+	item = json_object_new_object();
+	x_mutex_lock(&cache.mutex);
+	json_object_object_add(item, "hits", json_object_new_int64((int64_t)cache.hits));
+	json_object_object_add(item, "misses", json_object_new_int64((int64_t)cache.misses));
+	x_mutex_unlock(&cache.mutex);
+	json_object_object_add(resu, "cache", item);
+	afs_sessions_counters(resu);
+	afs_federation_counters(resu);
+	afb_json_legacy_req_reply_hookable(req, resu, NULL, NULL);
+}
+
+/*************************************************************************************/
+
+/* fan-out of a request to many superviseds */
+struct fanout
+{
+	/* the originating request */
+	struct afb_req_common *req;
+
+	/* the aggregated result keyed by pid */
+	struct json_object *result;
+
+	/* count of pending replies */
+	unsigned pending;
+
+	/* protection of the result */
+	x_mutex_t mutex;
+};
+
+/* one call of a fan-out */
+struct fanout_call
+{
+	/* the fan-out */
+	struct fanout *fanout;
+
+	/* pid of the called supervised */
+	int pid;
+
+	/* slot of cache of the reply */
+	int slot;
+
+	/* the called supervised when the reply is to be cached */
+	struct supervised *supervised;
+
+	/* time of the forwarding in us */
+	uint64_t forwarded_us;
+};
+
+/* selection of superviseds */
+struct selection
+{
+	/* the selected superviseds */
+	struct supervised **items;
+
+	/* count of selected superviseds */
+	unsigned count;
+
+	/* allocated count of items */
+	unsigned size;
+
+	/* filter of the selection or NULL for all */
+	struct json_object *filter;
+};
+
+/**
+ * add 's' to the 'selection', returns 0 on success or X_ENOMEM
+ */
+static int selection_add(struct selection *selection, struct supervised *s)
+{
+	struct supervised **items;
+	unsigned size;
+
+	if (selection->count == selection->size) {
+		size = selection->size ? selection->size << 1 : 16;
+		items = realloc(selection->items, size * sizeof *items);
+		if (!items)
+			return X_ENOMEM;
+		selection->items = items;
+		selection->size = size;
+	}
+	selection->items[selection->count++] = supervised_addref(s);
+	return 0;
+}
+
+/**
+ * release the items of the 'selection'
+ */
+static void selection_release(struct selection *selection)
+{
+	while (selection->count)
+		supervised_unref(selection->items[--selection->count]);
+	free(selection->items);
+}
+
+#if WITH_CRED
+/**
+ * check if 'value' matches the 'filter' item of 'key'
+ */
+static int match_string(struct json_object *filter, const char *key, const char *value)
+{
+	struct json_object *item;
+
+	return !json_object_object_get_ex(filter, key, &item)
+		|| (value && !fnmatch(json_object_get_string(item), value, 0));
+}
+
+/**
+ * check if 'value' matches the 'filter' item of 'key'
+ */
+static int match_int(struct json_object *filter, const char *key, int value)
+{
+	struct json_object *item;
+
+	return !json_object_object_get_ex(filter, key, &item)
+		|| json_object_get_int(item) == value;
+}
+#endif
+
+/**
+ * check if the supervised 's' matches the 'filter'
+ */
+static int selection_match(struct json_object *filter, struct supervised *s)
+{
+#if WITH_CRED
+	return !filter || (
+		   match_int(filter, "uid", (int)s->cred->uid)
+		&& match_int(filter, "gid", (int)s->cred->gid)
+		&& match_string(filter, "id", s->cred->id)
+		&& match_string(filter, "label", s->cred->label)
+		&& match_string(filter, "user", s->cred->user));
+#else
+	return 1;
+#endif
+}
+
+static void selection_add_matching(void *closure, struct supervised *s)
+{
+	struct selection *selection = closure;
+
+	if (selection_match(selection->filter, s))
+		selection_add(selection, s);
+}
+
+/**
+ * Releases one pending count of the 'fanout' and replies to
+ * the request when no more reply is pending.
+ */
+static void fanout_release(struct fanout *fanout)
+{
+	unsigned pending;
+
+	x_mutex_lock(&fanout->mutex);
+	pending = --fanout->pending;
+	x_mutex_unlock(&fanout->mutex);
+
+	if (!pending) {
+		afb_json_legacy_req_reply_hookable(fanout->req, fanout->result, NULL, NULL);
+		afb_req_common_unref(fanout->req);
+		free(fanout);
+	}
+}
+
+/**
+ * Records in the 'result' of the fan-out the 'status' of 'pid'
+ * with its 'response' and 'info' and release its pending count.
+ */
+static void fanout_record(
+		struct fanout *fanout,
+		int pid,
+		const char *status,
+		struct json_object *response,
+		const char *info
+) {
+	char spid[50];
+	struct json_object *item;
+
+	item = json_object_new_object();
+	json_object_object_add(item, "status", json_object_new_string(status ?: "success"));
+	if (info)
+		json_object_object_add(item, "info", json_object_new_string(info));
+	if (response)
+		json_object_object_add(item, "response", json_object_get(response));
+	sprintf(spid, "%d", pid);
+
+	x_mutex_lock(&fanout->mutex);
+	json_object_object_add(fanout->result, spid, item);
+	x_mutex_unlock(&fanout->mutex);
+
+	fanout_release(fanout);
+}
+
+static void fanout_on_json_reply(void *closure, struct json_object *object, const char *error, const char *info)
+{
+	struct fanout_call *call = closure;
+
+	fanout_record(call->fanout, call->pid, error, object, info);
+}
+
+static void fanout_on_reply(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	struct fanout_call *call = closure;
+
+	afs_metrics_reply(call->pid, call->fanout->req->verbname, status, call->forwarded_us);
+	if (call->supervised) {
+		if (status >= 0 && nreplies == 1)
+			cache_put(call->supervised, call->slot, replies[0]);
+		supervised_unref(call->supervised);
+	}
+	afb_json_legacy_do_reply_json_c(call, status, nreplies, replies, fanout_on_json_reply);
+	free(call);
+}
+
+/**
+ * Selects the superviseds designated by 'spec' in 'selection'.
+ * The spec can be "all" or "*" for all superviseds, an object
+ * for filtering on credentials or an array of pids. Unknown pids
+ * of arrays are recorded in 'unknowns'.
+ */
+static int select_superviseds(struct selection *selection, struct json_object *spec, struct json_object *unknowns)
+{
+	size_t i, n;
+	int pid, rc;
+	struct supervised *s;
+
+	rc = 0;
+	if (json_object_is_type(spec, json_type_array)) {
+		n = json_object_array_length(spec);
+		for (i = 0 ; i < n && rc >= 0 ; i++) {
+			pid = json_object_get_int(json_object_array_get_idx(spec, i));
+			s = pid ? supervised_of_pid(pid) : NULL;
+			if (s)
+				rc = selection_add(selection, s);
+			else
+				json_object_array_add(unknowns, json_object_new_int(pid));
+			supervised_unref(s);
+		}
+	}
+	else {
+		selection->filter = json_object_is_type(spec, json_type_object) ? spec : NULL;
+		supervised_for_all(selection_add_matching, selection);
+	}
+	return rc;
+}
+
+/**
+ * Forwards the request 'req' of arguments 'args' to all the superviseds
+ * designated by 'spec' (see select_superviseds). The replies are
+ * aggregated in one object keyed by pid.
+ */
+static void propagate_many(struct afb_req_common *req, struct json_object *args, const char *verb, int trace, struct json_object *spec)
+{
+	struct selection selection;
+	struct json_object *unknowns;
+	struct fanout *fanout;
+	struct fanout_call *call;
+	struct afb_data *data, *cached;
+	unsigned i, n;
+	int rc, slot;
+
+	/* select the targets */
+	memset(&selection, 0, sizeof selection);
+	unknowns = json_object_new_array();
+	rc = select_superviseds(&selection, spec, unknowns);
+	n = (unsigned)json_object_array_length(unknowns);
+	if (rc < 0 || (fanout = malloc(sizeof *fanout)) == NULL) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+		goto end;
+	}
+	fanout->req = afb_req_common_addref(req);
+	fanout->result = json_object_new_object();
+	fanout->pending = selection.count + n + 1;
+	x_mutex_init(&fanout->mutex);
+
+	/* record unknown pids */
+	for (i = 0 ; i < n ; i++)
+		fanout_record(fanout, json_object_get_int(json_object_array_get_idx(unknowns, i)), "unknown-pid", NULL, NULL);
+
+	/* dispatch the calls */
+	slot = cache_slot(verb, args);
+	json_object_object_del(args, "pid");
+	rc = afb_json_legacy_make_data_json_c(&data, json_object_get(args));
+	for (i = 0 ; i < selection.count ; i++) {
+		call = rc < 0 ? NULL : malloc(sizeof *call);
+		if (!call)
+			fanout_record(fanout, selection.items[i]->pid, "internal-error", NULL, NULL);
+		else if (slot != CACHE_NONE && cache_get(selection.items[i], slot, &cached)) {
+			/* served from the cache */
+			call->fanout = fanout;
+			call->pid = selection.items[i]->pid;
+			afb_json_legacy_do_reply_json_c(call, 0, 1, &cached, fanout_on_json_reply);
+			afb_data_unref(cached);
+			free(call);
+		}
+		else {
+			call->fanout = fanout;
+			call->pid = selection.items[i]->pid;
+			call->slot = slot;
+			call->supervised = slot == CACHE_NONE ? NULL : supervised_addref(selection.items[i]);
+			call->forwarded_us = afs_metrics_now();
+			afs_metrics_forward(call->pid);
+			afb_data_addref(data);
+			if (trace == TRACE_FILTERED)
+				afs_call_as(selection.items[i]->stub, verb, 1, &data, req,
+					selection.items[i]->tracer, fanout_on_reply, call);
+			else
+				afs_call(selection.items[i]->stub, verb, 1, &data, req,
+					trace ? selection.items[i]->tracer : NULL, fanout_on_reply, call);
+		}
+	}
+	if (rc >= 0)
+		afb_data_unref(data);
+
+	/* release the dispatching count */
+	fanout_release(fanout);
+end:
+	json_object_put(unknowns);
+	selection_release(&selection);
+}
+
+/* a request forwarded to one supervised */
+struct forwarding
+{
+	/* the forwarded request */
+	struct afb_req_common *req;
+
+	/* the supervised */
+	struct supervised *supervised;
+
+	/* slot of cache of the reply */
+	int slot;
+
+	/* time of the forwarding in us */
+	uint64_t forwarded_us;
+};
+
+/**
+ * relay to the request of the forwarding 'closure' the reply of the supervised
+ */
+static void forwarding_reply(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	struct forwarding *fwd = closure;
+	unsigned i;
+
+	afs_metrics_reply(fwd->supervised->pid, fwd->req->verbname, status, fwd->forwarded_us);
+	if (fwd->slot != CACHE_NONE && status >= 0 && nreplies == 1)
+		cache_put(fwd->supervised, fwd->slot, replies[0]);
+	for (i = 0 ; i < nreplies ; i++)
+		afb_data_addref(replies[i]);
+	afb_req_common_reply_hookable(fwd->req, status, nreplies, replies);
+	afb_req_common_unref(fwd->req);
+	supervised_unref(fwd->supervised);
+	free(fwd);
+}
+
+/**
+ * Forwards the request 'req' to the supervised 's' as 'verb' (or the verb
+ * of the request if NULL) with the parameters 'params' that are consumed.
+ * The trace events subscribed are watched according to the mode 'trace'.
+ * The reply is served from or recorded in the cache 'slot' if not CACHE_NONE.
+ */
+static void forward(
+		struct afb_req_common *req,
+		struct supervised *s,
+		const char *verb,
+		unsigned nparams,
+		struct afb_data * const params[],
+		int trace,
+		int slot
+) {
+	struct forwarding *fwd;
+	struct afb_data *cached;
+	unsigned i;
+
+	/* serve from the cache */
+	if (slot != CACHE_NONE && cache_get(s, slot, &cached)) {
+		for (i = 0 ; i < nparams ; i++)
+			afb_data_unref(params[i]);
+		afb_req_common_reply_hookable(req, 0, 1, &cached);
+		return;
+	}
+
+	fwd = malloc(sizeof *fwd);
+	if (!fwd) {
+		for (i = 0 ; i < nparams ; i++)
+			afb_data_unref(params[i]);
+		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+		return;
+	}
+	fwd->req = afb_req_common_addref(req);
+	fwd->supervised = supervised_addref(s);
+	fwd->slot = slot;
+	fwd->forwarded_us = afs_metrics_now();
+	afs_metrics_forward(s->pid);
+
+	/* the reply is relayed through the forwarding for timing it */
+	if (trace == TRACE_FILTERED)
+		afs_call_as(s->stub, verb ?: req->verbname, nparams, params, req,
+				s->tracer, forwarding_reply, fwd);
+	else
+		afs_call(s->stub, verb ?: req->verbname, nparams, params, req,
+				trace == TRACE_NONE ? NULL : s->tracer,
+				forwarding_reply, fwd);
+}
+
+static void propagate(struct afb_req_common *req, struct json_object *args, const char *verb, int trace)
+{
+	struct json_object *item;
+	struct supervised *s;
+	struct afb_data *data;
+	int p, rc, slot;
+
+	/* for a child supervisor? */
+	if (afs_federation_route(req, args))
+		return;
+
+	/* extract the pid */
+	if (!json_object_object_get_ex(args, "pid", &item)) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "no-pid", NULL);
+		return;
+	}
+
+	/* forward to many superviseds? */
+	if (json_object_is_type(item, json_type_array)
+	 || json_object_is_type(item, json_type_object)
+	 || (json_object_is_type(item, json_type_string)
+	  && (!strcmp(json_object_get_string(item), "all")
+	   || !strcmp(json_object_get_string(item), "*")))) {
+		propagate_many(req, args, verb ?: req->verbname, trace, item);
+		return;
+	}
+
+	p = json_object_get_int(item);
+	if (!p) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "bad-pid", NULL);
+		return;
+	}
+
+	/* get supervised of pid */
+	s = supervised_of_pid((pid_t)p);
+	if (!s) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "unknown-pid", NULL);
+		return;
+	}
+	json_object_object_del(args, "pid");
+	slot = cache_slot(verb ?: req->verbname, args);
+
+	rc = afb_json_legacy_make_data_json_c(&data, json_object_get(args));
+	if (rc < 0) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+		supervised_unref(s);
+		return;
+	}
+
+	/* forward it now */
+	forward(req, s, verb, 1, &data, trace, slot);
+	supervised_unref(s);
+}
+
+static void f_do(struct afb_req_common *req, struct json_object *args)
+{
+	propagate(req, args, NULL, 0);
+}
+
+static void f_config(struct afb_req_common *req, struct json_object *args)
+{
+	propagate(req, args, NULL, 0);
+}
+
+/* the traces added to daemons for a filtered subscription */
+struct trace_filter
+{
+	/* designation of the traced daemons (see select_superviseds) */
+	struct json_object *spec;
+
+	/* tag of the traces */
+	char tag[24];
+};
+
+/* counter for the tags of the filtered traces */
+static unsigned trace_filter_counter;
+
+static void trace_filter_dropped(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+}
+
+/*
+ * create the trace filter of the arguments 'args' of trace, the traces
+ * it adds are tagged for being dropped
+ */
+static struct trace_filter *trace_filter_create(struct json_object *args)
+{
+	struct trace_filter *tf;
+	struct json_object *item, *add;
+	size_t i, n;
+
+	tf = malloc(sizeof *tf);
+	if (!tf)
+		return NULL;
+	snprintf(tf->tag, sizeof tf->tag, "filter-%u",
+		__atomic_add_fetch(&trace_filter_counter, 1, __ATOMIC_RELAXED));
+	if (!json_object_object_get_ex(args, "pid", &item))
+		tf->spec = NULL;
+	else if (json_object_is_type(item, json_type_int)) {
+		tf->spec = json_object_new_array();
+		json_object_array_add(tf->spec, json_object_get(item));
+	}
+	else
+		tf->spec = json_object_get(item);
+
+	if (json_object_object_get_ex(args, "add", &add)) {
+		if (json_object_is_type(add, json_type_object))
+			json_object_object_add(add, "tag", json_object_new_string(tf->tag));
+		else if (json_object_is_type(add, json_type_array)) {
+			n = json_object_array_length(add);
+			for (i = 0 ; i < n ; i++) {
+				item = json_object_array_get_idx(add, i);
+				if (json_object_is_type(item, json_type_object))
+					json_object_object_add(item, "tag", json_object_new_string(tf->tag));
+			}
+		}
+	}
+	return tf;
+}
+
+/*
+ * drop from its daemons the traces of the trace filter 'closure' and free it
+ */
+static void trace_filter_ended(void *closure)
+{
+	struct trace_filter *tf = closure;
+	struct selection selection;
+	struct json_object *args, *drop, *unknowns;
+	struct afb_data *data;
+	unsigned i;
+
+	memset(&selection, 0, sizeof selection);
+	unknowns = json_object_new_array();
+	if (tf->spec && unknowns && select_superviseds(&selection, tf->spec, unknowns) >= 0 && selection.count) {
+		args = json_object_new_object();
+		drop = json_object_new_object();
+		json_object_object_add(drop, "tag", json_object_new_string(tf->tag));
+		json_object_object_add(args, "drop", drop);
+		if (afb_json_legacy_make_data_json_c(&data, args) >= 0) {
+			for (i = 0 ; i < selection.count ; i++) {
+				afb_data_addref(data);
+				afs_call(selection.items[i]->stub, "trace", 1, &data, NULL, NULL, trace_filter_dropped, NULL);
+			}
+			afb_data_unref(data);
+		}
+	}
+	selection_release(&selection);
+	json_object_put(unknowns);
+	json_object_put(tf->spec);
+	free(tf);
+}
+
+static void f_trace(struct afb_req_common *req, struct json_object *args)
+{
+	struct json_object *filter;
+	struct trace_filter *tf;
+	struct afb_evt *evt;
+	int rc;
+
+	if (afs_federation_route(req, args))
+		return;
+
+	if (!json_object_object_get_ex(args, "filter", &filter)) {
+		propagate(req, args, NULL, TRACE_RELAYED);
+		return;
+	}
+
+	/*
+	 * subscribe the client to its own filtered trace event once the filter
+	 * is accepted, the traces added to the daemons are dropped when the
+	 * client no longer listens
+	 */
+	rc = afb_api_common_new_event(supervisor_api, "trace", &evt);
+	if (rc >= 0) {
+		tf = trace_filter_create(args);
+		rc = tf ? afs_trace_subscribe(evt, filter, trace_filter_ended, tf) : X_ENOMEM;
+		if (rc >= 0)
+			rc = afb_req_common_subscribe(req, evt);
+		else if (tf) {
+			json_object_put(tf->spec);
+			free(tf);
+		}
+		afb_evt_unref(evt);
+	}
+	if (rc < 0) {
+		afb_json_legacy_req_reply_hookable(req, NULL, rc == X_EINVAL ? "bad-filter" : "internal-error", NULL);
+		return;
+	}
+	json_object_object_del(args, "filter");
+	propagate(req, args, NULL, TRACE_FILTERED);
+}
+
+static void f_trace_query(struct afb_req_common *req, struct json_object *args)
+{
+	afb_json_legacy_req_reply_hookable(req, afs_trace_query(args), NULL, NULL);
+}
+
+static void f_metrics(struct afb_req_common *req, struct json_object *args)
+{
+	if (afs_federation_route(req, args))
+		return;
+	afb_json_legacy_req_reply_hookable(req, afs_metrics_query(args), NULL, NULL);
+}
+
+/* name and tag of the trace of requests made for the statistics */
+static const char stats_trace_name[] = "supervisor-stats";
+
+static void f_stats(struct afb_req_common *req, struct json_object *args)
+{
+	struct json_object *item, *spec;
+
+	if (afs_federation_route(req, args))
+		return;
+
+	if (!json_object_object_get_ex(args, "enable", &item)) {
+		afb_json_legacy_req_reply_hookable(req, afs_stats_query(args), NULL, NULL);
+		return;
+	}
+
+	/* start or stop the trace of the requests of the daemons */
+	spec = json_object_new_object();
+	json_object_object_add(spec, "tag", json_object_new_string(stats_trace_name));
+	if (json_object_get_boolean(item)) {
+		json_object_object_add(spec, "name", json_object_new_string(stats_trace_name));
+		json_object_object_add(spec, "request", json_object_new_string("common"));
+		json_object_object_add(args, "add", spec);
+	}
+	else
+		json_object_object_add(args, "drop", spec);
+	json_object_object_del(args, "enable");
+	propagate(req, args, "trace", TRACE_FILTERED);
 }
 
-/**
- * Search the supervised of 'pid', return it or NULL.
- */
-static struct supervised *supervised_of_pid(int pid)
+static void f_sessions(struct afb_req_common *req, struct json_object *args)
 {
-	struct supervised *s;
+	propagate(req, args, "slist", 0);
+}
 
-	x_mutex_lock(&mutex);
-	s = superviseds;
-	while (s && pid != s->pid)
-		s = s->next;
-	x_mutex_unlock(&mutex);
+static void f_session_close(struct afb_req_common *req, struct json_object *args)
+{
+	propagate(req, args, "sclose", 0);
+}
 
-	return s;
+/*************************************************************************************/
+
+/* period in ms of the ticks of probing */
+#define PROBE_TICK_MS 100
+
+/* maximal count of daemons probed or detected stalled by tick */
+#define PROBE_BATCH 64
+
+/* the probing of the daemons */
+static struct {
+	/* the ticking timer */
+	struct ev_timer *timer;
+
+	/* the verb of the probes */
+	const char *verb;
 }
+	probing;
 
-/*
- * handles incoming connection on 'sock'
+/**
+ * Pushes the event stalled for 'pid': stalled when 'rtt_us' is zero
+ * or recovered after 'rtt_us'
  */
-static void accept_supervision_link(int sock)
+static void push_stalled(int pid, uint64_t rtt_us)
 {
-	int rc, fd;
-	struct sockaddr addr;
-	socklen_t lenaddr;
-#if WITH_CRED
-	struct afb_cred *cred;
-#endif
+	struct json_object *obj;
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "pid", json_object_new_int(pid));
+	json_object_object_add(obj, "recovered", json_object_new_boolean(rtt_us != 0));
+	if (rtt_us)
+		json_object_object_add(obj, "rtt", json_object_new_int64((int64_t)rtt_us));
+	afb_json_legacy_event_push(event_stalled, obj);
+}
 
-	lenaddr = (socklen_t)sizeof addr;
-	fd = accept(sock, &addr, &lenaddr);
-	if (fd >= 0) {
-#if WITH_CRED
-		afb_cred_create_for_socket(&cred, fd);
-		rc = should_accept(cred);
-		if (rc) {
-#endif
-			rc = send_initiator(fd, NULL);
-			if (!rc) {
-#if WITH_CRED
-				rc = make_supervised(fd, cred);
-#else
-				rc = make_supervised(fd);
-#endif
-				if (rc > 0) {
-					afb_json_legacy_event_push(event_add_pid, json_object_new_int(rc));
-					return;
-				}
-			}
-#if WITH_CRED
-		}
-		afb_cred_unref(cred);
-#endif
-		close(fd);
+static void probe_on_reply(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	int pid = (int)(intptr_t)closure;
+	uint64_t rtt;
+
+	rtt = afs_health_reply(pid, status, afs_metrics_now());
+	if (rtt) {
+		LIBAFB_NOTICE("daemon %d recovered after %llu us", pid, (unsigned long long)rtt);
+		push_stalled(pid, rtt);
 	}
 }
 
 /*
- * handle even on server socket
+ * tick of the probing: sends the due probes and detects the stalls
  */
-static void listening(struct ev_fd *efd, int fd, uint32_t revents, void *closure)
+static void probe_tick(struct ev_timer *timer, void *closure, unsigned decount)
 {
-	if ((revents & EV_FD_HUP) != 0) {
-		LIBAFB_ERROR("supervision socket closed");
-		exit(1);
+	int pids[PROBE_BATCH];
+	unsigned i, n;
+	uint64_t now;
+	struct supervised *s;
+	struct afb_data *data;
+
+	now = afs_metrics_now();
+	n = afs_health_due(now, pids, PROBE_BATCH);
+	for (i = 0 ; i < n ; i++) {
+		s = supervised_of_pid(pids[i]);
+		if (!s)
+			afs_health_forget(pids[i]);
+		else if (afb_json_legacy_make_data_json_c(&data, json_object_new_object()) < 0)
+			afs_health_reply(pids[i], X_ENOMEM, now);
+		else
+			afs_call(s->stub, probing.verb, 1, &data, NULL, NULL, probe_on_reply, (void*)(intptr_t)pids[i]);
+		supervised_unref(s);
+	}
+
+	n = afs_health_stalls(now, pids, PROBE_BATCH);
+	for (i = 0 ; i < n ; i++) {
+		LIBAFB_WARNING("daemon %d stalled", pids[i]);
+		push_stalled(pids[i], 0);
 	}
-	if ((revents & EV_FD_IN) != 0)
-		accept_supervision_link(fd);
 }
 
-/*
- */
-static void discovered_cb(void *closure, pid_t pid)
+int afs_supervisor_probe(unsigned period_ms, unsigned stall_ms, const char *verb)
 {
-	struct supervised *s;
+	int rc;
 
-	s = supervised_of_pid(pid);
-	if (!s) {
-		(*(int*)closure)++;
-		kill(pid, SIGHUP);
+	if (probing.timer || !period_ms)
+		return 0;
+	probing.verb = verb;
+	afs_health_configure(period_ms, stall_ms);
+	rc = afb_ev_mgr_add_timer(&probing.timer, 0,
+			0, PROBE_TICK_MS,
+			0, PROBE_TICK_MS, PROBE_TICK_MS / 10, probe_tick, NULL, 0);
+	if (rc < 0) {
+		probing.timer = NULL;
+		afs_health_configure(0, 0);
 	}
+	return rc;
 }
 
-int afs_supervisor_discover()
+static void f_health(struct afb_req_common *req, struct json_object *args)
 {
-	int n = 0;
-	afs_discover("afb-daemon", discovered_cb, &n);
-	return n;
+	if (afs_federation_route(req, args))
+		return;
+	afb_json_legacy_req_reply_hookable(req, afs_health_query(args), NULL, NULL);
 }
 
 /*************************************************************************************/
 
-static void f_subscribe(struct afb_req_common *req, struct json_object *args)
+/* period in ms of the ticks refreshing the index of sessions */
+#define SESSIONS_TICK_MS 1000
+
+/* maximal count of daemons refreshed by tick */
+#define SESSIONS_BATCH 32
+
+/* the periodic refresh of the index of sessions */
+static struct {
+	/* the ticking timer */
+	struct ev_timer *timer;
+
+	/* age in us of the sessions of a daemon before refreshing them */
+	uint64_t period_us;
+}
+	sessions_refreshing;
+
+/* a refresh of the index of sessions for a request */
+struct refresh
 {
-	int revoke, ok;
+	/* protection of the pending count */
+	x_mutex_t mutex;
 
-	revoke = json_object_is_type(args, json_type_boolean)
-		&& !json_object_get_boolean(args);
+	/* count of pending replies */
+	unsigned pending;
 
-	ok = 1;
-	if (!revoke) {
-		ok = !afb_req_common_subscribe(req, event_add_pid)
-			&& !afb_req_common_subscribe(req, event_del_pid);
-	}
-	if (revoke || !ok) {
-		afb_req_common_unsubscribe(req, event_add_pid);
-		afb_req_common_unsubscribe(req, event_del_pid);
+	/* the request and its arguments */
+	struct afb_req_common *req;
+	struct json_object *args;
+
+	/* the handler of the request when refreshed */
+	void (*done)(struct afb_req_common *req, struct json_object *args);
+};
+
+/* a call of slist refreshing the index */
+struct refresh_call
+{
+	/* the refresh or NULL */
+	struct refresh *refresh;
+
+	/* the pid of the called daemon */
+	int pid;
+};
+
+/**
+ * Releases one pending count of 'refresh' and handles the request
+ * when no more reply is pending.
+ */
+static void refresh_release(struct refresh *refresh)
+{
+	unsigned pending;
+
+	x_mutex_lock(&refresh->mutex);
+	pending = --refresh->pending;
+	x_mutex_unlock(&refresh->mutex);
+
+	if (!pending) {
+		refresh->done(refresh->req, refresh->args);
+		json_object_put(refresh->args);
+		afb_req_common_unref(refresh->req);
+		free(refresh);
 	}
-	afb_json_legacy_req_reply_hookable(req, NULL, ok ? NULL : "error", NULL);
 }
 
-static void f_list(struct afb_req_common *req, struct json_object *args)
+static void refresh_on_json_reply(void *closure, struct json_object *object, const char *error, const char *info)
 {
-	char pid[50];
-	struct json_object *resu, *item;
-	struct supervised *s;
+	struct refresh_call *call = closure;
 
-	resu = json_object_new_object();
-	s = superviseds;
-	while (s) {
-		sprintf(pid, "%d", (int)s->pid);
-		item = NULL;
-#if WITH_CRED
-		resu = json_object_new_object();
-		json_object_object_add(resu, "pid", json_object_new_int((int)s->cred->pid));
-		json_object_object_add(resu, "uid", json_object_new_int((int)s->cred->uid));
-		json_object_object_add(resu, "gid", json_object_new_int((int)s->cred->gid));
-		json_object_object_add(resu, "id", json_object_new_string(s->cred->id));
-		json_object_object_add(resu, "label", json_object_new_string(s->cred->label));
-		json_object_object_add(resu, "user", json_object_new_string(s->cred->user));
-#endif
-		json_object_object_add(resu, pid, item);
-		s = s->next;
-	}
-	afb_json_legacy_req_reply_hookable(req, resu, NULL, NULL);
+	afs_sessions_set(call->pid, error ? NULL : object, afs_metrics_now());
 }
 
-static void f_discover(struct afb_req_common *req, struct json_object *args)
+static void refresh_on_reply(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
 {
-	afs_supervisor_discover();
-	afb_json_legacy_req_reply_hookable(req, NULL, NULL, NULL);
+	struct refresh_call *call = closure;
+
+	afb_json_legacy_do_reply_json_c(call, status, nreplies, replies, refresh_on_json_reply);
+	if (call->refresh)
+		refresh_release(call->refresh);
+	free(call);
 }
 
-static void propagate(struct afb_req_common *req, struct json_object *args, const char *verb)
+/**
+ * Refreshes the sessions of 's' in the index on behalf of 'refresh'
+ */
+static void refresh_one(struct refresh *refresh, struct supervised *s)
 {
-	struct json_object *item;
-	struct supervised *s;
-	struct afb_api_item api;
+	struct refresh_call *call;
 	struct afb_data *data;
-	int p, rc;
 
-	/* extract the pid */
-	if (!json_object_object_get_ex(args, "pid", &item)) {
-		afb_json_legacy_req_reply_hookable(req, NULL, "no-pid", NULL);
+	call = malloc(sizeof *call);
+	if (!call || afb_json_legacy_make_data_json_c(&data, json_object_new_object()) < 0) {
+		free(call);
+		afs_sessions_set(s->pid, NULL, afs_metrics_now());
 		return;
 	}
-
-	p = json_object_get_int(item);
-	if (!p) {
-		afb_json_legacy_req_reply_hookable(req, NULL, "bad-pid", NULL);
-		return;
+	call->refresh = refresh;
+	call->pid = s->pid;
+	if (refresh) {
+		x_mutex_lock(&refresh->mutex);
+		refresh->pending++;
+		x_mutex_unlock(&refresh->mutex);
 	}
+	afs_call(s->stub, "slist", 1, &data, NULL, NULL, refresh_on_reply, call);
+}
 
-	/* get supervised of pid */
-	s = supervised_of_pid((pid_t)p);
-	if (!s) {
-		afb_json_legacy_req_reply_hookable(req, NULL, "unknown-pid", NULL);
-		return;
-	}
-	json_object_object_del(args, "pid");
+/**
+ * Refreshes concurrently the sessions of all the daemons then
+ * calls 'done' for the request 'req' of arguments 'args'
+ */
+static void refresh_all(struct afb_req_common *req, struct json_object *args,
+		void (*done)(struct afb_req_common *req, struct json_object *args))
+{
+	struct selection selection;
+	struct refresh *refresh;
+	unsigned i;
 
-	rc = afb_json_legacy_make_data_json_c(&data, json_object_get(args));
-	if (rc < 0) {
+	refresh = malloc(sizeof *refresh);
+	if (!refresh) {
 		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
 		return;
 	}
+	x_mutex_init(&refresh->mutex);
+	refresh->pending = 1;
+	refresh->req = afb_req_common_addref(req);
+	refresh->args = json_object_get(args);
+	refresh->done = done;
+
+	memset(&selection, 0, sizeof selection);
+	supervised_for_all(selection_add_matching, &selection);
+	for (i = 0 ; i < selection.count ; i++)
+		refresh_one(refresh, selection.items[i]);
+	selection_release(&selection);
+	refresh_release(refresh);
+}
+
+/*
+ * tick of the periodic refresh: refreshes the oldest daemons
+ */
+static void sessions_tick(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	int pids[SESSIONS_BATCH];
+	unsigned i, n;
+	uint64_t now;
+	struct supervised *s;
+
+	now = afs_metrics_now();
+	n = afs_sessions_due(now, sessions_refreshing.period_us, pids, SESSIONS_BATCH);
+	for (i = 0 ; i < n ; i++) {
+		s = supervised_of_pid(pids[i]);
+		if (s)
+			refresh_one(NULL, s);
+		else
+			afs_sessions_set(pids[i], NULL, now);
+		supervised_unref(s);
+	}
+}
 
-	/* forward it now */
-	afb_req_common_prepare_forwarding(req, "S", verb, 1, &data);
-	api = afb_stub_ws_client_api(s->stub);
-	api.itf->process(api.closure, req);
+int afs_supervisor_set_session_refresh(unsigned period_ms)
+{
+	int rc;
+
+	sessions_refreshing.period_us = (uint64_t)period_ms * 1000;
+	if (sessions_refreshing.timer || !period_ms)
+		return 0;
+	rc = afb_ev_mgr_add_timer(&sessions_refreshing.timer, 0,
+			SESSIONS_TICK_MS / 1000, SESSIONS_TICK_MS % 1000,
+			0, SESSIONS_TICK_MS, SESSIONS_TICK_MS / 10, sessions_tick, NULL, 0);
+	if (rc < 0)
+		sessions_refreshing.timer = NULL;
+	return rc;
 }
 
-static void f_do(struct afb_req_common *req, struct json_object *args)
+static void session_find(struct afb_req_common *req, struct json_object *args)
 {
-	propagate(req, args, NULL);
+	struct json_object *resu, *item;
+
+	json_object_object_get_ex(args, "uuid", &item);
+	resu = json_object_new_object();
+	json_object_object_add(resu, "uuid", json_object_get(item));
+	json_object_object_add(resu, "pids", afs_sessions_lookup(json_object_get_string(item)));
+	afb_json_legacy_req_reply_hookable(req, resu, NULL, NULL);
 }
 
-static void f_config(struct afb_req_common *req, struct json_object *args)
+static void session_close_all(struct afb_req_common *req, struct json_object *args)
 {
-	propagate(req, args, NULL);
+	struct json_object *item, *pids;
+
+	json_object_object_get_ex(args, "uuid", &item);
+	pids = afs_sessions_lookup(json_object_get_string(item));
+	afs_sessions_drop(json_object_get_string(item));
+	json_object_object_del(args, "refresh");
+	json_object_object_add(args, "pid", pids);
+	propagate_many(req, args, "sclose", 0, pids);
 }
 
-static void f_trace(struct afb_req_common *req, struct json_object *args)
+/**
+ * Handles the request 'req' of arguments 'args' with 'handler',
+ * after refreshing the index when "refresh" is true
+ */
+static void session_index(struct afb_req_common *req, struct json_object *args,
+		void (*handler)(struct afb_req_common *req, struct json_object *args))
 {
-	propagate(req, args, NULL);
+	struct json_object *item;
+
+	if (afs_federation_route(req, args))
+		return;
+	if (!json_object_object_get_ex(args, "uuid", &item)
+	 || !json_object_is_type(item, json_type_string)) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "no-uuid", NULL);
+		return;
+	}
+	if (json_object_object_get_ex(args, "refresh", &item) && json_object_get_boolean(item))
+		refresh_all(req, args, handler);
+	else
+		handler(req, args);
 }
 
-static void f_sessions(struct afb_req_common *req, struct json_object *args)
+static void f_session_find(struct afb_req_common *req, struct json_object *args)
 {
-	propagate(req, args, "slist");
+	session_index(req, args, session_find);
 }
 
-static void f_session_close(struct afb_req_common *req, struct json_object *args)
+static void f_session_close_all(struct afb_req_common *req, struct json_object *args)
 {
-	propagate(req, args, "sclose");
+	session_index(req, args, session_close_all);
 }
 
 static void f_exit(struct afb_req_common *req, struct json_object *args)
 {
-	propagate(req, args, NULL);
+	propagate(req, args, NULL, 0);
+	afb_json_legacy_req_reply_hookable(req, NULL, NULL, NULL);
+}
+
+static void f_handoff(struct afb_req_common *req, struct json_object *args)
+{
+	struct ev_timer *timer;
+
+	/* the requests forwarded would be lost */
+	if (afs_metrics_inflight()) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "busy", NULL);
+		return;
+	}
+	if (afb_ev_mgr_add_timer(&timer, 0, 0, HANDOFF_DELAY_MS, 1, 0, 1, handoff_cb, NULL, 1) < 0) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+		return;
+	}
 	afb_json_legacy_req_reply_hookable(req, NULL, NULL, NULL);
 }
 
 static void f_debug_wait(struct afb_req_common *req, struct json_object *args)
 {
-	propagate(req, args, "wait");
+	propagate(req, args, "wait", 0);
 	afb_json_legacy_req_reply_hookable(req, NULL, NULL, NULL);
 }
 
 static void f_debug_break(struct afb_req_common *req, struct json_object *args)
 {
-	propagate(req, args, "break");
+	propagate(req, args, "break", 0);
 	afb_json_legacy_req_reply_hookable(req, NULL, NULL, NULL);
 }
 
 /***************************************************************************/
 
-static struct afb_api_common *supervisor_api;
-
 static void supervisor_process(void *closure, struct afb_req_common *req);
 static void supervisor_describe(void *closure, void (*describecb)(void *, struct json_object *), void *clocb);
 
@@ -463,19 +2692,127 @@ static const struct afb_auth _afb_auths_v2_supervisor[] = {
 
 /***************************************************************************/
 
-void checkcb(void *closure, int status)
+/* description of verbs forwarded without decoding */
+struct raw_forward
+{
+	/* name of the verb of the supervisor */
+	const char *name;
+
+	/* name of the verb of the supervised */
+	const char *verb;
+
+	/* is a reply to be sent by the supervisor? */
+	int reply;
+
+	/* are trace events to be recorded? */
+	int trace;
+};
+
+/* verbs forwarded as VERB/PID without decoding */
+static const struct raw_forward raw_forwards[] =
+{
+	{ .name = "config",        .verb = "config", .reply = 0 },
+	{ .name = "debug-break",   .verb = "break",  .reply = 1 },
+	{ .name = "debug-wait",    .verb = "wait",   .reply = 1 },
+	{ .name = "do",            .verb = "do",     .reply = 0 },
+	{ .name = "exit",          .verb = "exit",   .reply = 1 },
+	{ .name = "session-close", .verb = "sclose", .reply = 0 },
+	{ .name = "sessions",      .verb = "slist",  .reply = 0 },
+	{ .name = "trace",         .verb = "trace",  .reply = 0, .trace = TRACE_RELAYED },
+	{ .name = NULL,            .verb = NULL,     .reply = 0 }
+};
+
+/**
+ * Forwards the request 'req' whose verb is VERB/PID to the supervised
+ * of PID. The parameters of the request are given to the supervised
+ * unchanged, without being decoded and encoded again.
+ * Returns 0 if the verb isn't of the form VERB/PID or 1 when the
+ * request is handled.
+ */
+static int raw_forward(struct afb_req_common *req)
+{
+	const struct raw_forward *fwd;
+	const char *slash;
+	char *end;
+	long p;
+	size_t len;
+	unsigned i, n;
+	struct supervised *s;
+	struct afb_data *data[req->params.ndata + 1];
+
+	/* split VERB/PID */
+	slash = strchr(req->verbname, '/');
+	if (!slash)
+		return 0;
+	len = (size_t)(slash - req->verbname);
+	for (fwd = raw_forwards ; fwd->name ; fwd++)
+		if (!strncmp(req->verbname, fwd->name, len) && !fwd->name[len])
+			break;
+	if (!fwd->name)
+		return 0;
+
+	/* get the pid */
+	p = strtol(&slash[1], &end, 10);
+	if (*end || end == &slash[1] || p <= 0 || p > INT32_MAX) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "bad-pid", NULL);
+		return 1;
+	}
+
+	/* get supervised of pid */
+	s = supervised_of_pid((int)p);
+	if (!s) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "unknown-pid", NULL);
+		return 1;
+	}
+
+	/* forward the parameters unchanged */
+	n = req->params.ndata;
+	for (i = 0 ; i < n ; i++)
+		data[i] = afb_data_addref(req->params.data[i]);
+	forward(req, s, fwd->verb, n, data, fwd->trace, cache_slot(fwd->verb, NULL));
+	supervised_unref(s);
+	if (fwd->reply)
+		afb_json_legacy_req_reply_hookable(req, NULL, NULL, NULL);
+	return 1;
+}
+
+/***************************************************************************/
+
+/* a request being processed */
+struct processing
+{
+	/* the request */
+	struct afb_req_common *req;
+
+	/* time of reception in us */
+	uint64_t received_us;
+};
+
+static void checkcb(void *closure, int status)
 {
-	struct afb_req_common *req = closure;
+	struct processing *processing = closure;
+	struct afb_req_common *req = processing->req;
 	void (*fun)(struct afb_req_common*, struct json_object*);
+	uint64_t authorized_us;
 
 	if (status <= 0)
-		return;
+		goto end;
+
+	authorized_us = afs_metrics_now();
+	if (raw_forward(req)) {
+		afs_metrics_request(req->verbname, processing->received_us, authorized_us, afs_metrics_now());
+		goto end;
+	}
 
 	fun = NULL;
 	switch (req->verbname[0]) {
 	case 'c':
 		if (!strcmp(req->verbname, "config"))
 			fun = f_config;
+		else if (!strcmp(req->verbname, "counters"))
+			fun = f_counters;
+		else if (!strcmp(req->verbname, "changes-since"))
+			fun = f_changes_since;
 		break;
 
 	case 'd':
@@ -494,23 +2831,43 @@ void checkcb(void *closure, int status)
 			fun = f_exit;
 		break;
 
+	case 'h':
+		if (!strcmp(req->verbname, "handoff"))
+			fun = f_handoff;
+		else if (!strcmp(req->verbname, "health"))
+			fun = f_health;
+		break;
+
 	case 'l':
 		if (!strcmp(req->verbname, "list"))
 			fun = f_list;
 		break;
 
+	case 'm':
+		if (!strcmp(req->verbname, "metrics"))
+			fun = f_metrics;
+		break;
+
 	case 's':
 		if (!strcmp(req->verbname, "subscribe"))
 			fun = f_subscribe;
+		else if (!strcmp(req->verbname, "stats"))
+			fun = f_stats;
 		else if (!strcmp(req->verbname, "sessions"))
 			fun = f_sessions;
 		else if (!strcmp(req->verbname, "session-close"))
 			fun = f_session_close;
+		else if (!strcmp(req->verbname, "session-find"))
+			fun = f_session_find;
+		else if (!strcmp(req->verbname, "session-close-all"))
+			fun = f_session_close_all;
 		break;
 
 	case 't':
 		if (!strcmp(req->verbname, "trace"))
 			fun = f_trace;
+		else if (!strcmp(req->verbname, "trace-query"))
+			fun = f_trace_query;
 		break;
 
 	default:
@@ -521,12 +2878,25 @@ void checkcb(void *closure, int status)
 	}
 	else {
 		afb_json_legacy_do_single_json_c(req->params.ndata, req->params.data, (void(*)(void*,struct json_object*))fun, req);
+		afs_metrics_request(req->verbname, processing->received_us, authorized_us, afs_metrics_now());
 	}
+end:
+	afb_req_common_unref(req);
+	free(processing);
 }
 
 static void supervisor_process(void *closure, struct afb_req_common *req)
 {
-	afb_req_common_check_and_set_session_async(req, &_afb_auths_v2_supervisor[0], AFB_SESSION_CHECK, checkcb, req);
+	struct processing *processing;
+
+	processing = malloc(sizeof *processing);
+	if (!processing) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+		return;
+	}
+	processing->req = afb_req_common_addref(req);
+	processing->received_us = afs_metrics_now();
+	afb_req_common_check_and_set_session_async(req, &_afb_auths_v2_supervisor[0], AFB_SESSION_CHECK, checkcb, processing);
 }
 
 static void supervisor_describe(void *closure, void (*describecb)(void *, struct json_object *), void *clocb)
@@ -534,6 +2904,142 @@ static void supervisor_describe(void *closure, void (*describecb)(void *, struct
 	describecb(clocb, NULL /* TODO */);
 }
 
+/* verbs served to the parent supervisor: reading and forwarding */
+static const char *upstream_verbs[] =
+{
+	"changes-since",
+	"config",
+	"counters",
+	"do",
+	"health",
+	"list",
+	"metrics",
+	"session-find",
+	"sessions",
+	"stats",
+	"subscribe",
+	"trace",
+	"trace-query",
+	NULL
+};
+
+/**
+ * Processes the request 'req' of the parent supervisor if its verb,
+ * or the VERB of VERB/PID, is served to the parent
+ */
+static void upstream_process(void *closure, struct afb_req_common *req)
+{
+	const char **verb;
+	size_t len;
+
+	len = strcspn(req->verbname, "/");
+	for (verb = upstream_verbs ; *verb ; verb++) {
+		if (!strncmp(req->verbname, *verb, len) && !(*verb)[len]) {
+			supervisor_process(closure, req);
+			return;
+		}
+	}
+	afb_req_common_reply_verb_unknown_error_hookable(req);
+}
+
+static struct afb_api_itf upstream_itf =
+{
+	.process = upstream_process,
+	.describe = supervisor_describe
+};
+
+int afs_supervisor_add_upstream(struct afb_apiset *set)
+{
+	struct afb_api_item item;
+
+	item.closure = NULL;
+	item.group = NULL;
+	item.itf = &upstream_itf;
+	return afb_apiset_add(set, supervisor_apiname, item);
+}
+
+/**
+ * print to 'file' the line of the metric 'name' of 'type' and 'value'
+ */
+static void print_metric(FILE *file, const char *name, const char *type, uint64_t value)
+{
+	fprintf(file, "# TYPE %s %s\n%s %llu\n", name, type, name, (unsigned long long)value);
+}
+
+/**
+ * Renders in 'text' of 'length' the metrics in the text exposition
+ * format of Prometheus, the returned text must be freed
+ */
+int afs_supervisor_metrics_text(char **text, size_t *length)
+{
+	FILE *file;
+	unsigned count;
+	struct afs_trace_stats tstats;
+
+	file = open_memstream(text, length);
+	if (!file)
+		return X_ENOMEM;
+
+	x_rwlock_rdlock(&registry.rwlock);
+	count = registry.count;
+	x_rwlock_unlock(&registry.rwlock);
+	print_metric(file, "afb_supervisor_supervised", "gauge", count);
+
+	x_mutex_lock(&accepting.mutex);
+	print_metric(file, "afb_supervisor_connections_total", "counter", accepting.accepted);
+	print_metric(file, "afb_supervisor_rejections_total", "counter", accepting.rejected);
+	print_metric(file, "afb_supervisor_hangups_total", "counter", accepting.hangups);
+	x_mutex_unlock(&accepting.mutex);
+
+	x_mutex_lock(&discovery.mutex);
+	print_metric(file, "afb_supervisor_discovery_scans_total", "counter", discovery.scans);
+	fprintf(file, "# TYPE afb_supervisor_discovery_scan_seconds_total counter\n"
+		"afb_supervisor_discovery_scan_seconds_total %g\n"
+		"# TYPE afb_supervisor_discovery_scan_seconds_last gauge\n"
+		"afb_supervisor_discovery_scan_seconds_last %g\n"
+		"# TYPE afb_supervisor_discovery_scan_seconds_max gauge\n"
+		"afb_supervisor_discovery_scan_seconds_max %g\n",
+		(double)discovery.total_us / 1e6,
+		(double)discovery.last_us / 1e6,
+		(double)discovery.max_us / 1e6);
+	x_mutex_unlock(&discovery.mutex);
+
+	afs_trace_get_stats(&tstats);
+	print_metric(file, "afb_supervisor_trace_events_total", "counter", tstats.received);
+	print_metric(file, "afb_supervisor_trace_pushed_total", "counter", tstats.pushed);
+	print_metric(file, "afb_supervisor_trace_messages_total", "counter", tstats.messages);
+
+	afs_metrics_print(file);
+	afs_health_print(file);
+
+	return fclose(file) ? X_ENOMEM : 0;
+}
+
+int afs_supervisor_set_coalescing(unsigned window_ms)
+{
+	coalescing.window_ms = window_ms;
+	return 0;
+}
+
+int afs_supervisor_set_cache_ttl(unsigned ttl_ms)
+{
+	cache.ttl_ms = ttl_ms;
+	return 0;
+}
+
+int afs_supervisor_set_trace_ring(unsigned count)
+{
+	return afs_trace_init(count);
+}
+
+int afs_supervisor_set_socket(const char *uri)
+{
+	if (supervision_efd)
+		return X_EBUSY;
+	supervision_socket_path = uri ?: default_supervision_socket_path;
+	return 0;
+}
+
 int afs_supervisor_add(struct afb_apiset *declare_set, struct afb_apiset *call_set)
 {
 	struct afb_api_item item;
@@ -564,6 +3070,15 @@ int afs_supervisor_add(struct afb_apiset *declare_set, struct afb_apiset *call_s
 	if (rc == 0 && !event_del_pid) {
 		rc = afb_api_common_new_event(supervisor_api, "del-pid", &event_del_pid);
 	}
+	if (rc == 0 && !event_changed) {
+		rc = afb_api_common_new_event(supervisor_api, "changed", &event_changed);
+	}
+	if (rc == 0 && !event_pids) {
+		rc = afb_api_common_new_event(supervisor_api, "pids", &event_pids);
+	}
+	if (rc == 0 && !event_stalled) {
+		rc = afb_api_common_new_event(supervisor_api, "stalled", &event_stalled);
+	}
 
 	/* create an empty set for superviseds */
 	if (rc == 0 && !empty_apiset) {
@@ -576,12 +3091,17 @@ int afs_supervisor_add(struct afb_apiset *declare_set, struct afb_apiset *call_s
 
 	/* create supervision socket */
 	if (rc == 0 && !supervision_efd) {
-		rc = afb_socket_open(supervision_socket_path, 1);
+		fd = afs_handoff_inherited(AFS_HANDOFF_LISTENER);
+		rc = fd >= 0 ? fd : afb_socket_open(supervision_socket_path, 1);
 		if (rc >= 0) {
 			fd = rc;
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
 			rc = afb_ev_mgr_add_fd(&supervision_efd, fd, EV_FD_IN, listening, 0, 0, 1);
 			if (rc < 0)
 				close(fd);
+			else
+				supervision_fd = fd;
 		}
 	}
 
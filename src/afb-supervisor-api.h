@@ -23,8 +23,27 @@
 
 #pragma once
 
+#include <stddef.h>
 
 extern int afs_supervisor_discover();
+extern int afs_supervisor_discover_later(unsigned delay_ms);
+extern int afs_supervisor_warm_start(const char *path);
+extern int afs_supervisor_watch();
+extern int afs_supervisor_auto_discover(unsigned min_ms, unsigned max_ms);
+extern int afs_supervisor_pace_wakeups(unsigned rate, unsigned batch, unsigned timeout_ms, unsigned retries);
+extern int afs_supervisor_set_socket(const char *uri);
+extern int afs_supervisor_set_trace_ring(unsigned count);
+extern int afs_supervisor_set_cache_ttl(unsigned ttl_ms);
+extern int afs_supervisor_set_coalescing(unsigned window_ms);
+extern int afs_supervisor_set_session_refresh(unsigned period_ms);
+extern int afs_supervisor_probe(unsigned period_ms, unsigned stall_ms, const char *verb);
+extern int afs_supervisor_metrics_text(char **text, size_t *length);
 extern int afs_supervisor_add(
 		struct afb_apiset *declare_set,
 		struct afb_apiset * call_set);
+
+/**
+ * Adds to 'set' the supervisor api restricted to the verbs served to
+ * a parent supervisor (reading and forwarding)
+ */
+extern int afs_supervisor_add_upstream(struct afb_apiset *set);
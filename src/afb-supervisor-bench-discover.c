@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+/*
+ * Benchmark and test of the discovery of daemons against synthetic
+ * trees of processes.
+ *
+ * For each SIZE (default 1000, 10000 and 100000), it creates in DIR
+ * (default a new directory of /tmp) a tree of SIZE processes whose
+ * 'exe' links to the daemon for MATCH per thousand of them (default
+ * 10) and whose 'stat' gives a start time. It measures the first scan
+ * and the following SCANS scans (default 32): durations, system calls
+ * and daemons found. Then it checks that a pid reused by another
+ * program is no more found after some scans.
+ *
+ * usage: afb-supervisor-bench-discover [-d DIR] [-m MATCH] [-s SCANS] [-k] [SIZE...]
+ *
+ * The system calls are counted by wrapping the functions of the libc
+ * used by afb-discover.c at link time (see src/CMakeLists.txt).
+ * Exits with 1 when a count of daemons found is wrong.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "afb-discover.h"
+
+/* basename of the simulated daemons */
+#define DAEMON "afb-daemon"
+
+/* maximal count of scans for detecting a reused pid */
+#define REUSE_SCANS_MAX 64
+
+/* counts of system calls */
+static struct {
+	unsigned long getdents, readlink, open, read, close, other;
+}
+	calls;
+
+/*************************************************************************************/
+/* WRAPPERS OF THE LIBC                                                              */
+/*************************************************************************************/
+
+extern long __real_syscall(long number, ...);
+extern ssize_t __real_readlinkat(int dirfd, const char *path, char *buf, size_t size);
+extern int __real_openat(int dirfd, const char *path, int flags, ...);
+extern int __real_open(const char *path, int flags, ...);
+extern ssize_t __real_read(int fd, void *buf, size_t count);
+extern int __real_close(int fd);
+extern off_t __real_lseek(int fd, off_t offset, int whence);
+
+/* the calls made by afb-discover.c have 3 arguments */
+long __wrap_syscall(long number, ...)
+{
+	va_list ap;
+	long a, b, c;
+
+	va_start(ap, number);
+	a = va_arg(ap, long);
+	b = va_arg(ap, long);
+	c = va_arg(ap, long);
+	va_end(ap);
+	calls.getdents++;
+	return __real_syscall(number, a, b, c);
+}
+
+ssize_t __wrap_readlinkat(int dirfd, const char *path, char *buf, size_t size)
+{
+	calls.readlink++;
+	return __real_readlinkat(dirfd, path, buf, size);
+}
+
+int __wrap_openat(int dirfd, const char *path, int flags, ...)
+{
+	calls.open++;
+	return __real_openat(dirfd, path, flags);
+}
+
+int __wrap_open(const char *path, int flags, ...)
+{
+	calls.open++;
+	return __real_open(path, flags);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	calls.read++;
+	return __real_read(fd, buf, count);
+}
+
+int __wrap_close(int fd)
+{
+	calls.close++;
+	return __real_close(fd);
+}
+
+off_t __wrap_lseek(int fd, off_t offset, int whence)
+{
+	calls.other++;
+	return __real_lseek(fd, offset, whence);
+}
+
+static unsigned long total_calls()
+{
+	return calls.getdents + calls.readlink + calls.open + calls.read + calls.close + calls.other;
+}
+
+/*************************************************************************************/
+/* SYNTHETIC TREES                                                                   */
+/*************************************************************************************/
+
+/* is the process 'pid' a daemon for 'match' per thousand? */
+static int is_daemon(unsigned pid, unsigned match)
+{
+	return (pid * 2654435761u) % 1000 < match;
+}
+
+/* set the process 'pid' of the tree 'root' running 'exe' started at 'start' */
+static int set_process(int root, unsigned pid, const char *exe, unsigned long long start)
+{
+	char path[64], stat[256];
+	int fd, len;
+
+	snprintf(path, sizeof path, "%u", pid);
+	if (mkdirat(root, path, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	snprintf(path, sizeof path, "%u/exe", pid);
+	unlinkat(root, path, 0);
+	if (symlinkat(exe, root, path) < 0)
+		return -1;
+
+	snprintf(path, sizeof path, "%u/stat", pid);
+	len = snprintf(stat, sizeof stat,
+		"%u (%s) S 1 %u %u 0 -1 4194560 100 0 0 0 1 1 0 0 20 0 1 0 %llu 1000000 100\n",
+		pid, strrchr(exe, '/') + 1, pid, pid, start);
+	fd = openat(root, path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	if (write(fd, stat, (size_t)len) != len) {
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+/* create in 'dir' a tree of 'size' processes, return the count of daemons or -1 */
+static int make_tree(const char *dir, unsigned size, unsigned match)
+{
+	char exe[64];
+	unsigned pid;
+	int root, count;
+
+	if (mkdir(dir, 0755) < 0)
+		return -1;
+	root = open(dir, O_RDONLY | O_DIRECTORY);
+	if (root < 0)
+		return -1;
+
+	/* entries that aren't processes */
+	mkdirat(root, "sys", 0755);
+	mkdirat(root, "net", 0755);
+	symlinkat("1", root, "self");
+
+	for (count = 0, pid = 1 ; pid <= size ; pid++) {
+		if (is_daemon(pid, match)) {
+			snprintf(exe, sizeof exe, "/usr/bin/" DAEMON);
+			count++;
+		}
+		else
+			snprintf(exe, sizeof exe, "/usr/bin/program-%u", pid % 97);
+		if (set_process(root, pid, exe, 1000 + pid) < 0) {
+			close(root);
+			return -1;
+		}
+	}
+	close(root);
+	return count;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+/*************************************************************************************/
+/* MEASURES                                                                          */
+/*************************************************************************************/
+
+static unsigned hits;
+
+static void found(void *closure, pid_t pid)
+{
+	hits++;
+}
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* scan once, return the duration in us */
+static uint64_t scan()
+{
+	uint64_t start;
+
+	hits = 0;
+	start = now_us();
+	afs_discover(DAEMON, found, NULL);
+	return now_us() - start;
+}
+
+/* benchmark the tree 'dir' of 'size' processes with 'daemons' for 'match' */
+static int bench(const char *dir, unsigned size, unsigned match, unsigned daemons, unsigned scans)
+{
+	uint64_t cold, duration, total, min, max;
+	unsigned long cold_calls, warm_calls;
+	unsigned i, pid;
+	int root, rc;
+
+	rc = 0;
+	afs_discover_set_root(dir);
+
+	/* first scan */
+	memset(&calls, 0, sizeof calls);
+	cold = scan();
+	cold_calls = total_calls();
+	if (hits != daemons) {
+		fprintf(stderr, "size %u: first scan found %u daemons instead of %u\n", size, hits, daemons);
+		rc = 1;
+	}
+
+	/* next scans */
+	total = max = 0;
+	min = UINT64_MAX;
+	memset(&calls, 0, sizeof calls);
+	for (i = 0 ; i < scans ; i++) {
+		duration = scan();
+		total += duration;
+		min = duration < min ? duration : min;
+		max = duration > max ? duration : max;
+		if (hits != daemons) {
+			fprintf(stderr, "size %u: scan %u found %u daemons instead of %u\n", size, i, hits, daemons);
+			rc = 1;
+		}
+	}
+	warm_calls = scans ? total_calls() / scans : 0;
+	printf("%8u %8u %10llu %10llu %10llu %10llu %10lu %10lu %8.1f\n",
+		size, daemons,
+		(unsigned long long)cold,
+		(unsigned long long)(scans ? total / scans : 0),
+		(unsigned long long)(scans ? min : 0),
+		(unsigned long long)max,
+		cold_calls, warm_calls,
+		scans ? (double)calls.getdents / scans : 0.0);
+
+	/* reuse the pid of a daemon for another program */
+	for (pid = 1 ; pid <= size && !is_daemon(pid, match) ; pid++);
+	root = open(dir, O_RDONLY | O_DIRECTORY);
+	if (pid <= size && root >= 0 && set_process(root, pid, "/usr/bin/reused", 999999) == 0) {
+		for (i = 1 ; i <= REUSE_SCANS_MAX ; i++) {
+			scan();
+			if (hits == daemons - 1)
+				break;
+		}
+		if (i > REUSE_SCANS_MAX) {
+			fprintf(stderr, "size %u: reused pid %u still found after %u scans\n", size, pid, REUSE_SCANS_MAX);
+			rc = 1;
+		}
+		else
+			printf("%8s reused pid %u not found after %u scans\n", "", pid, i);
+	}
+	if (root >= 0)
+		close(root);
+	return rc;
+}
+
+int main(int ac, char **av)
+{
+	static unsigned default_sizes[] = { 1000, 10000, 100000 };
+	char template[] = "/tmp/afb-bench-discover-XXXXXX", path[PATH_MAX];
+	const char *dir;
+	unsigned i, size, match, scans, nsizes, *sizes;
+	int opt, keep, daemons, rc;
+
+	dir = NULL;
+	match = 10;
+	scans = 32;
+	keep = 0;
+	while ((opt = getopt(ac, av, "d:m:s:k")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'm':
+			match = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			scans = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d DIR] [-m MATCH] [-s SCANS] [-k] [SIZE...]\n", av[0]);
+			return 1;
+		}
+	}
+	if (!match || match > 1000) {
+		fprintf(stderr, "MATCH must be in 1..1000\n");
+		return 1;
+	}
+	if (optind < ac) {
+		nsizes = (unsigned)(ac - optind);
+		sizes = calloc(nsizes, sizeof *sizes);
+		if (!sizes)
+			return 1;
+		for (i = 0 ; i < nsizes ; i++)
+			sizes[i] = (unsigned)strtoul(av[optind + (int)i], NULL, 10);
+	}
+	else {
+		nsizes = sizeof default_sizes / sizeof *default_sizes;
+		sizes = default_sizes;
+	}
+	if (!dir) {
+		dir = mkdtemp(template);
+		if (!dir) {
+			fprintf(stderr, "can't create a directory: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	printf("%8s %8s %10s %10s %10s %10s %10s %10s %8s\n",
+		"size", "daemons", "first-us", "scan-us", "min-us", "max-us", "first-sys", "scan-sys", "getdents");
+	rc = 0;
+	for (i = 0 ; i < nsizes ; i++) {
+		size = sizes[i];
+		snprintf(path, sizeof path, "%s/proc-%u", dir, size);
+		daemons = make_tree(path, size, match);
+		if (daemons < 0) {
+			fprintf(stderr, "can't create the tree %s: %s\n", path, strerror(errno));
+			rc = 1;
+		}
+		else if (bench(path, size, match, (unsigned)daemons, scans))
+			rc = 1;
+		if (!keep)
+			nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	}
+	if (!keep && dir == template)
+		rmdir(dir);
+	return rc;
+}
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+/*
+ * Load benchmark of the supervisor.
+ *
+ * It connects to the ws-server of the supervisor, gets the supervised
+ * daemons with list, then keeps CONCURRENCY calls in flight for
+ * DURATION seconds, cycling through the VERBS (default list, do and
+ * subscribe) and the daemons. It reports for each verb the throughput
+ * and the p50, p99 and p999 latencies.
+ *
+ * The simulated daemons don't emit trace events: trace only measures
+ * the relay of the request and is called only when given with -v.
+ *
+ * usage: afb-supervisor-bench-load -w URI [-d DURATION] [-c CONCURRENCY]
+ *                                  [-v VERB,...] [-a API/VERB]
+ *
+ * ex: afb-supervisor --port 1619 --ws-server unix:/tmp/supervisor --supervision-socket unix:/tmp/sim
+ *     afb-supervisor-simulator -n 1000 -s unix:/tmp/sim -l 2
+ *     afb-supervisor-bench-load -w unix:/tmp/supervisor -d 10 -c 64
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <json-c/json.h>
+
+#include <libafb/core/afb-apiset.h>
+#include <libafb/core/afb-data.h>
+#include <libafb/core/afb-session.h>
+#include <libafb/core/afb-json-legacy.h>
+#include <libafb/core/afb-sched.h>
+#include <libafb/wsapi/afb-stub-ws.h>
+#include <libafb/misc/afb-socket.h>
+#include <libafb/misc/afb-supervisor.h>
+#include <libafb/misc/afb-verbose.h>
+
+#include "afb-supervisor-call.h"
+
+/* the verbs of the benchmark */
+enum verb { Verb_List, Verb_Do, Verb_Trace, Verb_Subscribe, Verb_Count };
+
+static const char *verb_names[Verb_Count] = { "list", "do", "trace", "subscribe" };
+
+/* the verbs called by default */
+static const enum verb default_verbs[] = { Verb_List, Verb_Do, Verb_Subscribe };
+
+/* latencies in us of the calls of a verb */
+struct latencies
+{
+	uint32_t *values;
+	size_t count, size;
+};
+
+/* the benchmark, the calls being processed by only one thread */
+static struct {
+	/* uri of the ws-server of the supervisor */
+	const char *uri;
+
+	/* duration in seconds */
+	unsigned duration;
+
+	/* count of calls in flight */
+	unsigned concurrency;
+
+	/* api and verb called by do */
+	const char *api, *verb;
+
+	/* the verbs to call */
+	enum verb verbs[Verb_Count];
+	unsigned nverbs;
+
+	/* the connection */
+	struct afb_stub_ws *stub;
+
+	/* pids of the daemons */
+	int *pids;
+	unsigned npids;
+
+	/* rounds of the verbs and of the daemons */
+	unsigned round;
+
+	/* times in us of the start and of the end */
+	uint64_t start_us, end_us;
+
+	/* count of calls in flight */
+	unsigned inflight;
+
+	/* latencies and errors */
+	struct latencies latencies[Verb_Count];
+	uint64_t errors[Verb_Count];
+}
+	bench = {
+		.duration = 10,
+		.concurrency = 16
+	};
+
+/* a call in flight */
+struct probe
+{
+	/* the verb */
+	enum verb verb;
+
+	/* time in us of the call */
+	uint64_t sent_us;
+};
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* add the latency 'value' to 'lat' */
+static void latency_add(struct latencies *lat, uint64_t value)
+{
+	uint32_t *values;
+	size_t size;
+
+	if (lat->count == lat->size) {
+		size = lat->size ? 2 * lat->size : 4096;
+		values = realloc(lat->values, size * sizeof *values);
+		if (!values)
+			return;
+		lat->values = values;
+		lat->size = size;
+	}
+	lat->values[lat->count++] = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+static int cmp_values(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* the latency below which 'permil' per thousand of the sorted 'lat' fall */
+static unsigned long long latency_permil(const struct latencies *lat, unsigned permil)
+{
+	return lat->values[(lat->count - 1) * permil / 1000];
+}
+
+/* print the results and exit */
+static void report()
+{
+	double seconds;
+	unsigned i;
+	struct latencies *lat;
+
+	seconds = (double)(now_us() - bench.start_us) / 1e6;
+	printf("%u daemons, %u in flight, %.1f s\n", bench.npids, bench.concurrency, seconds);
+	printf("%-10s %10s %10s %8s %8s %8s %8s %8s\n",
+		"verb", "calls", "calls/s", "errors", "p50-us", "p99-us", "p999-us", "max-us");
+	for (i = 0 ; i < Verb_Count ; i++) {
+		lat = &bench.latencies[i];
+		if (!lat->count)
+			continue;
+		qsort(lat->values, lat->count, sizeof *lat->values, cmp_values);
+		printf("%-10s %10llu %10.1f %8llu %8llu %8llu %8llu %8llu\n",
+			verb_names[i],
+			(unsigned long long)lat->count,
+			(double)lat->count / seconds,
+			(unsigned long long)bench.errors[i],
+			latency_permil(lat, 500),
+			latency_permil(lat, 990),
+			latency_permil(lat, 999),
+			latency_permil(lat, 1000));
+	}
+	exit(0);
+}
+
+/* make the arguments of 'verb' for the daemon 'pid' */
+static struct json_object *make_args(enum verb verb, int pid)
+{
+	struct json_object *args, *add;
+
+	args = json_object_new_object();
+	switch (verb) {
+	case Verb_Do:
+		json_object_object_add(args, "pid", json_object_new_int(pid));
+		json_object_object_add(args, "api", json_object_new_string(bench.api));
+		json_object_object_add(args, "verb", json_object_new_string(bench.verb));
+		json_object_object_add(args, "args", json_object_new_object());
+		break;
+	case Verb_Trace:
+		add = json_object_new_object();
+		json_object_object_add(add, "request", json_object_new_string("common"));
+		json_object_object_add(args, "pid", json_object_new_int(pid));
+		json_object_object_add(args, "add", add);
+		break;
+	default:
+		break;
+	}
+	return args;
+}
+
+static void send_probe(struct probe *probe);
+
+static void on_reply(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	struct probe *probe = closure;
+
+	latency_add(&bench.latencies[probe->verb], now_us() - probe->sent_us);
+	if (status < 0)
+		bench.errors[probe->verb]++;
+	send_probe(probe);
+}
+
+/* send the next call with 'probe' or stop it after the end */
+static void send_probe(struct probe *probe)
+{
+	struct afb_data *data;
+	unsigned round;
+
+	probe->sent_us = now_us();
+	if (probe->sent_us >= bench.end_us) {
+		free(probe);
+		if (!--bench.inflight)
+			report();
+		return;
+	}
+	round = bench.round++;
+	probe->verb = bench.verbs[round % bench.nverbs];
+	if (afb_json_legacy_make_data_json_c(&data,
+			make_args(probe->verb, bench.pids[(round / bench.nverbs) % bench.npids])) < 0) {
+		on_reply(probe, -1, 0, NULL);
+		return;
+	}
+	afs_call(bench.stub, verb_names[probe->verb], 1, &data, NULL, NULL, on_reply, probe);
+}
+
+static void on_list_json(void *closure, struct json_object *object, const char *error, const char *info)
+{
+	struct probe *probe;
+	unsigned i;
+
+	/* get the pids */
+	if (error || !json_object_is_type(object, json_type_object)) {
+		fprintf(stderr, "can't list the daemons: %s\n", error ?: "bad reply");
+		exit(1);
+	}
+	bench.pids = malloc(((size_t)json_object_object_length(object) ?: 1) * sizeof *bench.pids);
+	if (!bench.pids)
+		exit(1);
+	json_object_object_foreach(object, key, value) {
+		(void)value;
+		bench.pids[bench.npids++] = atoi(key);
+	}
+	if (!bench.npids) {
+		fprintf(stderr, "no daemon supervised\n");
+		exit(1);
+	}
+
+	/* start the calls */
+	bench.start_us = now_us();
+	bench.end_us = bench.start_us + (uint64_t)bench.duration * 1000000;
+	for (i = 0 ; i < bench.concurrency ; i++) {
+		probe = malloc(sizeof *probe);
+		if (probe) {
+			bench.inflight++;
+			send_probe(probe);
+		}
+	}
+	if (!bench.inflight)
+		exit(1);
+}
+
+static void on_list(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	afb_json_legacy_do_reply_json_c(closure, status, nreplies, replies, on_list_json);
+}
+
+static void start(int signum, void *arg)
+{
+	struct afb_apiset *apiset;
+	struct afb_data *data;
+	int fd;
+
+	if (signum)
+		exit(1);
+
+	if (afb_session_init(10, 3600)) {
+		fprintf(stderr, "can't init the sessions\n");
+		exit(1);
+	}
+	apiset = afb_apiset_create("bench", 0);
+	fd = apiset ? afb_socket_open(bench.uri, 0) : -1;
+	if (fd < 0) {
+		fprintf(stderr, "can't connect to %s\n", bench.uri);
+		exit(1);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	bench.stub = afb_stub_ws_create_client(fd, 1, AFB_SUPERVISOR_APINAME, apiset);
+	if (!bench.stub
+	 || afb_json_legacy_make_data_json_c(&data, json_object_new_object()) < 0) {
+		fprintf(stderr, "can't call %s\n", bench.uri);
+		exit(1);
+	}
+	afs_call(bench.stub, "list", 1, &data, NULL, NULL, on_list, NULL);
+}
+
+/* set the verbs of the comma separated 'list' */
+static int set_verbs(char *list)
+{
+	char *name;
+	unsigned i;
+
+	bench.nverbs = 0;
+	for (name = strtok(list, ",") ; name ; name = strtok(NULL, ",")) {
+		for (i = 0 ; i < Verb_Count && strcmp(name, verb_names[i]) ; i++);
+		if (i == Verb_Count || bench.nverbs == Verb_Count)
+			return -1;
+		bench.verbs[bench.nverbs++] = (enum verb)i;
+	}
+	return bench.nverbs ? 0 : -1;
+}
+
+int main(int ac, char **av)
+{
+	int opt;
+	char *slash;
+
+	bench.api = "monitor";
+	bench.verb = "get";
+	for (opt = 0 ; opt < (int)(sizeof default_verbs / sizeof *default_verbs) ; opt++)
+		bench.verbs[opt] = default_verbs[opt];
+	bench.nverbs = (unsigned)opt;
+
+	while ((opt = getopt(ac, av, "w:d:c:v:a:")) != -1) {
+		switch (opt) {
+		case 'w':
+			bench.uri = optarg;
+			break;
+		case 'd':
+			bench.duration = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			bench.concurrency = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'v':
+			if (set_verbs(optarg) < 0) {
+				fprintf(stderr, "bad verbs %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'a':
+			slash = strchr(optarg, '/');
+			if (!slash) {
+				fprintf(stderr, "bad API/VERB %s\n", optarg);
+				return 1;
+			}
+			*slash = 0;
+			bench.api = optarg;
+			bench.verb = &slash[1];
+			break;
+		default:
+			bench.uri = NULL;
+			break;
+		}
+	}
+	if (!bench.uri || !bench.concurrency) {
+		fprintf(stderr, "usage: %s -w URI [-d DURATION] [-c CONCURRENCY] [-v VERB,...] [-a API/VERB]\n", av[0]);
+		return 1;
+	}
+
+	/* only one thread processes the calls */
+	afb_sched_start(1, 0, 16, start, NULL);
+	return 1;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <libafb/core/afb-cred.h>
+#include <libafb/core/afb-req-common.h>
+#include <libafb/core/afb-session.h>
+#include <libafb/core/afb-data.h>
+#include <libafb/core/afb-evt.h>
+#include <libafb/wsapi/afb-stub-ws.h>
+
+#include <libafb/misc/afb-verbose.h>
+#include <libafb/sys/x-errno.h>
+
+#include "afb-supervisor-call.h"
+
+/* name of the api of the calls */
+static const char call_apiname[] = "S";
+
+/* the session of calls not made on behalf of a request */
+static struct afb_session *call_session;
+
+/* internal call */
+struct call
+{
+	/* the request */
+	struct afb_req_common comreq;
+
+	/* the request on behalf of which the call is made or NULL */
+	struct afb_req_common *origin;
+
+	/* listener of the events subscribed or NULL */
+	struct afb_evt_listener *listener;
+
+	/* the callback */
+	afs_call_cb_t callback;
+
+	/* closure of the callback */
+	void *closure;
+};
+
+#define CALL_OF(comreq) ((struct call*)(((char*)(comreq)) - offsetof(struct call, comreq)))
+
+static void call_reply(struct afb_req_common *comreq, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	struct call *call = CALL_OF(comreq);
+	unsigned i;
+
+	if (call->callback)
+		call->callback(call->closure, status, nreplies, replies);
+	else {
+		/* relay the reply to the origin */
+		for (i = 0 ; i < nreplies ; i++)
+			afb_data_addref(replies[i]);
+		afb_req_common_reply_hookable(call->origin, status, nreplies, replies);
+	}
+}
+
+static void call_unref(struct afb_req_common *comreq)
+{
+	struct call *call = CALL_OF(comreq);
+
+	afb_req_common_cleanup(comreq);
+	if (call->origin)
+		afb_req_common_unref(call->origin);
+	if (call->listener)
+		afb_evt_listener_unref(call->listener);
+	free(call);
+}
+
+static int call_subscribe(struct afb_req_common *comreq, struct afb_evt *evt)
+{
+	struct call *call = CALL_OF(comreq);
+
+	if (call->listener)
+		afb_evt_listener_watch_evt(call->listener, evt);
+	return call->origin ? afb_req_common_subscribe(call->origin, evt) : call->listener ? 0 : X_ENOTSUP;
+}
+
+static int call_unsubscribe(struct afb_req_common *comreq, struct afb_evt *evt)
+{
+	struct call *call = CALL_OF(comreq);
+
+	return call->origin ? afb_req_common_unsubscribe(call->origin, evt) : call->listener ? 0 : X_ENOTSUP;
+}
+
+static const struct afb_req_common_query_itf call_itf =
+{
+	.reply = call_reply,
+	.unref = call_unref,
+	.subscribe = call_subscribe,
+	.unsubscribe = call_unsubscribe
+};
+
+/*
+ * makes the call, relaying to 'origin' when not NULL
+ * and using the session, the token and the credentials of 'identity'
+ * when not NULL
+ */
+static void make_call(
+	struct afb_stub_ws *stub,
+	const char *verb,
+	unsigned nparams,
+	struct afb_data * const params[],
+	struct afb_req_common *origin,
+	struct afb_req_common *identity,
+	struct afb_evt_listener *listener,
+	afs_call_cb_t callback,
+	void *closure
+) {
+	struct call *call;
+	struct afb_session *session;
+	struct afb_api_item api;
+	unsigned i;
+
+	/* get the session */
+	if (identity)
+		session = identity->session;
+	else {
+		if (!call_session
+		 && afb_session_create(&call_session, AFB_SESSION_TIMEOUT_INFINITE) < 0)
+			call_session = NULL;
+		session = call_session;
+	}
+
+	/* create the call */
+	call = session ? malloc(sizeof *call) : NULL;
+	if (!call) {
+		LIBAFB_ERROR("can't create internal call");
+		for (i = 0 ; i < nparams ; i++)
+			afb_data_unref(params[i]);
+		if (callback)
+			callback(closure, X_ENOMEM, 0, NULL);
+		else
+			afb_req_common_reply_hookable(origin, X_ENOMEM, 0, NULL);
+		return;
+	}
+	afb_req_common_init(&call->comreq, &call_itf, call_apiname, verb, nparams, params);
+	afb_req_common_set_session(&call->comreq, session);
+	if (identity) {
+		afb_req_common_set_token(&call->comreq, identity->token);
+#if WITH_CRED
+		afb_req_common_set_cred(&call->comreq, identity->credentials);
+#endif
+	}
+	call->origin = origin ? afb_req_common_addref(origin) : NULL;
+	call->listener = listener ? afb_evt_listener_addref(listener) : NULL;
+	call->callback = callback;
+	call->closure = closure;
+
+	/* process it now */
+	api = afb_stub_ws_client_api(stub);
+	api.itf->process(api.closure, &call->comreq);
+	afb_req_common_unref(&call->comreq);
+}
+
+void afs_call(
+	struct afb_stub_ws *stub,
+	const char *verb,
+	unsigned nparams,
+	struct afb_data * const params[],
+	struct afb_req_common *origin,
+	struct afb_evt_listener *listener,
+	afs_call_cb_t callback,
+	void *closure
+) {
+	make_call(stub, verb, nparams, params, origin, origin, listener, callback, closure);
+}
+
+void afs_call_as(
+	struct afb_stub_ws *stub,
+	const char *verb,
+	unsigned nparams,
+	struct afb_data * const params[],
+	struct afb_req_common *identity,
+	struct afb_evt_listener *listener,
+	afs_call_cb_t callback,
+	void *closure
+) {
+	make_call(stub, verb, nparams, params, NULL, identity, listener, callback, closure);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+struct afb_stub_ws;
+struct afb_data;
+struct afb_req_common;
+struct afb_evt_listener;
+
+/**
+ * Callback receiving the reply of a call made using afs_call.
+ * The replies are only valid during the callback and must be
+ * referenced (afb_data_addref) to be kept.
+ */
+typedef void (*afs_call_cb_t)(
+		void *closure,
+		int status,
+		unsigned nreplies,
+		struct afb_data * const replies[]);
+
+/**
+ * Calls the 'verb' of the supervision api of the daemon connected
+ * through 'stub' with the parameters 'params'. The parameters
+ * are consumed.
+ *
+ * When 'origin' isn't NULL, the call is made on behalf of that
+ * request: it uses its session, its token and its credentials and
+ * the subscriptions made by the daemon are forwarded to it.
+ *
+ * When 'listener' isn't NULL, it watches the events to which the
+ * daemon subscribes the call.
+ *
+ * The 'callback' is called with 'closure' on reply. When 'callback'
+ * is NULL, the reply is given to 'origin'.
+ */
+extern void afs_call(
+		struct afb_stub_ws *stub,
+		const char *verb,
+		unsigned nparams,
+		struct afb_data * const params[],
+		struct afb_req_common *origin,
+		struct afb_evt_listener *listener,
+		afs_call_cb_t callback,
+		void *closure);
+
+/**
+ * Same as afs_call but the call only takes the session, the token
+ * and the credentials of 'identity' (if not NULL): the subscriptions
+ * made by the daemon aren't forwarded to it and 'callback' can't
+ * be NULL.
+ */
+extern void afs_call_as(
+		struct afb_stub_ws *stub,
+		const char *verb,
+		unsigned nparams,
+		struct afb_data * const params[],
+		struct afb_req_common *identity,
+		struct afb_evt_listener *listener,
+		afs_call_cb_t callback,
+		void *closure);
@@ -0,0 +1,1024 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <json-c/json.h>
+
+#include <libafb/core/afb-req-common.h>
+#include <libafb/core/afb-apiset.h>
+#include <libafb/core/afb-data.h>
+#include <libafb/core/afb-evt.h>
+#include <libafb/core/afb-json-legacy.h>
+#include <libafb/wsapi/afb-stub-ws.h>
+
+#include <libafb/sys/ev-mgr.h>
+#include <libafb/core/afb-ev-mgr.h>
+#include <libafb/misc/afb-socket.h>
+
+#include <libafb/misc/afb-verbose.h>
+#include <libafb/sys/x-mutex.h>
+#include <libafb/sys/x-errno.h>
+
+#include <libafb/misc/afb-supervisor.h>
+
+#include "afb-supervisor-call.h"
+#include "afb-supervisor-federation.h"
+
+/* interface of the initiator of the registration of child supervisors */
+#define FEDERATION_INTERFACE "AFB-SUPERVISOR-FEDERATION-1"
+
+/* time in ms given to a child supervisor for sending its initiator */
+#define INITIATOR_TIMEOUT_MS 1000
+
+/* delay in ms before registering again with the parent supervisor */
+#define UPSTREAM_RETRY_MS 5000
+
+/* time in ms given to the connection with the parent supervisor */
+#define UPSTREAM_CONNECT_MS 5000
+
+/* a child supervisor */
+struct node
+{
+	/* next node */
+	struct node *next;
+
+	/* connection with the child */
+	struct afb_stub_ws *stub;
+
+	/* listener of the changes of the child */
+	struct afb_evt_listener *listener;
+
+	/* the daemons of the child, as returned by its list */
+	struct json_object *list;
+
+	/* generation of the list */
+	uint64_t generation;
+
+	/* is a resynchronization pending? */
+	int syncing;
+
+	/* reference count */
+	unsigned refcount;
+
+	/* name of the node */
+	char name[];
+};
+
+/* a child supervisor connected but not yet identified */
+struct newcomer
+{
+	/* watch of the connection */
+	struct ev_fd *efd;
+
+	/* expiration of the wait of the initiator */
+	struct ev_timer *timer;
+};
+
+/* a fan-out of a request to all the nodes */
+struct fedout
+{
+	/* protection of the result */
+	x_mutex_t mutex;
+
+	/* count of pending replies */
+	unsigned pending;
+
+	/* the request */
+	struct afb_req_common *req;
+
+	/* the result keyed by node */
+	struct json_object *result;
+};
+
+/* a call of a fan-out */
+struct fedcall
+{
+	/* the fan-out */
+	struct fedout *fedout;
+
+	/* name of the called node */
+	char name[];
+};
+
+/* the federation */
+static struct {
+	/* protection of the nodes and of the counters */
+	x_mutex_t mutex;
+
+	/* the child supervisors */
+	struct node *nodes;
+
+	/* the empty apiset of the connections to the children */
+	struct afb_apiset *apiset;
+
+	/* the listening socket */
+	struct ev_fd *efd;
+
+	/* counts of changes applied and of resynchronizations */
+	uint64_t deltas;
+	uint64_t resyncs;
+
+	/* the registration with the parent */
+	char *upstream;
+	char *node;
+	struct afb_apiset *exported;
+	struct afb_stub_ws *up;
+
+	/* the connection in progress with the parent */
+	struct ev_fd *connecting;
+	struct ev_timer *connect_timer;
+}
+	federation = { .mutex = X_MUTEX_INITIALIZER };
+
+/*************************************************************************************/
+/* CHILD SIDE                                                                        */
+/*************************************************************************************/
+
+static void upstream_connect(void);
+
+static void upstream_retry_cb(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	upstream_connect();
+}
+
+/* register again later */
+static void upstream_retry(void)
+{
+	struct ev_timer *timer;
+
+	if (afb_ev_mgr_add_timer(&timer, 0,
+			UPSTREAM_RETRY_MS / 1000, UPSTREAM_RETRY_MS % 1000,
+			1, 0, UPSTREAM_RETRY_MS / 10, upstream_retry_cb, NULL, 1) < 0)
+		LIBAFB_ERROR("can't retry registering with %s", federation.upstream);
+}
+
+static void upstream_hangup(struct afb_stub_ws *stub)
+{
+	LIBAFB_WARNING("disconnected from the parent supervisor %s", federation.upstream);
+	x_mutex_lock(&federation.mutex);
+	if (federation.up == stub)
+		federation.up = NULL;
+	x_mutex_unlock(&federation.mutex);
+	afb_stub_ws_unref(stub);
+	upstream_retry();
+}
+
+/*
+ * open a socket connecting without blocking to 'uri' (unix:PATH, unix:@NAME
+ * or tcp:HOST:PORT, the other schemes being opened by afb_socket_open),
+ * return the socket or a negative error code
+ */
+static int upstream_socket(const char *uri)
+{
+	struct sockaddr_un sun;
+	struct addrinfo hint, *addrs;
+	char host[256];
+	const char *port;
+	size_t len;
+	int fd, rc;
+
+	if (!strncmp(uri, "unix:", 5)) {
+		/* unix socket, abstract when starting with @ */
+		len = strlen(&uri[5]);
+		if (!len || len >= sizeof sun.sun_path)
+			return X_EINVAL;
+		memset(&sun, 0, sizeof sun);
+		sun.sun_family = AF_UNIX;
+		memcpy(sun.sun_path, &uri[5], len);
+		if (sun.sun_path[0] == '@')
+			sun.sun_path[0] = 0;
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -errno;
+		rc = connect(fd, (struct sockaddr*)&sun, (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + (sun.sun_path[0] != 0)));
+	}
+	else if (!strncmp(uri, "tcp:", 4)) {
+		/* tcp socket, the resolution of the host name may block */
+		port = strrchr(&uri[4], ':');
+		len = port ? (size_t)(port - &uri[4]) : 0;
+		if (!len || len >= sizeof host)
+			return X_EINVAL;
+		memcpy(host, &uri[4], len);
+		host[len] = 0;
+		memset(&hint, 0, sizeof hint);
+		hint.ai_family = AF_UNSPEC;
+		hint.ai_socktype = SOCK_STREAM;
+		hint.ai_flags = AI_NUMERICSERV;
+		if (getaddrinfo(host, &port[1], &hint, &addrs) != 0)
+			return X_EINVAL;
+		fd = socket(addrs->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		rc = fd < 0 ? -1 : connect(fd, addrs->ai_addr, addrs->ai_addrlen);
+		freeaddrinfo(addrs);
+		if (fd < 0)
+			return -errno;
+	}
+	else {
+		fd = afb_socket_open(uri, 0);
+		if (fd >= 0)
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		return fd;
+	}
+	if (rc < 0 && errno != EINPROGRESS) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+	return fd;
+}
+
+/* stop watching the connection in progress with the parent, return its socket */
+static int upstream_connect_release(void)
+{
+	int fd;
+
+	fd = ev_fd_fd(federation.connecting);
+	ev_fd_unref(federation.connecting);
+	ev_timer_unref(federation.connect_timer);
+	federation.connecting = NULL;
+	federation.connect_timer = NULL;
+	return fd;
+}
+
+/* register on the socket 'fd' connected to the parent */
+static void upstream_register(int fd)
+{
+	struct afb_supervisor_initiator asi;
+	struct afb_stub_ws *stub;
+
+	memset(&asi, 0, sizeof asi);
+	strcpy(asi.interface, FEDERATION_INTERFACE);
+	strncpy(asi.extra, federation.node, sizeof asi.extra - 1);
+	if (write(fd, &asi, sizeof asi) != (ssize_t)sizeof asi) {
+		LIBAFB_WARNING("can't register with the parent supervisor %s", federation.upstream);
+		close(fd);
+		upstream_retry();
+		return;
+	}
+	stub = afb_stub_ws_create_server(fd, 1, AFB_SUPERVISOR_APINAME, federation.exported);
+	if (!stub) {
+		close(fd);
+		upstream_retry();
+		return;
+	}
+	x_mutex_lock(&federation.mutex);
+	federation.up = stub;
+	x_mutex_unlock(&federation.mutex);
+	afb_stub_ws_set_on_hangup(stub, upstream_hangup);
+	LIBAFB_NOTICE("registered as %s with the parent supervisor %s", federation.node, federation.upstream);
+}
+
+/* the connection with the parent is established or failed */
+static void upstream_connected(struct ev_fd *efd, int fd, uint32_t revents, void *closure)
+{
+	int err;
+	socklen_t len;
+
+	upstream_connect_release();
+	len = sizeof err;
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if (err) {
+		LIBAFB_WARNING("can't connect to the parent supervisor %s: %s", federation.upstream, strerror(err));
+		close(fd);
+		upstream_retry();
+		return;
+	}
+	upstream_register(fd);
+}
+
+/* the connection with the parent did not complete in time */
+static void upstream_connect_expired(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	LIBAFB_WARNING("can't connect to the parent supervisor %s: timeout", federation.upstream);
+	close(upstream_connect_release());
+	upstream_retry();
+}
+
+/* connect without blocking to the parent and register once connected */
+static void upstream_connect(void)
+{
+	int fd, rc;
+
+	fd = upstream_socket(federation.upstream);
+	if (fd < 0) {
+		LIBAFB_WARNING("can't connect to the parent supervisor %s", federation.upstream);
+		upstream_retry();
+		return;
+	}
+	rc = afb_ev_mgr_add_timer(&federation.connect_timer, 0,
+			UPSTREAM_CONNECT_MS / 1000, UPSTREAM_CONNECT_MS % 1000,
+			1, 0, UPSTREAM_CONNECT_MS / 10, upstream_connect_expired, NULL, 0);
+	if (rc >= 0) {
+		rc = afb_ev_mgr_add_fd(&federation.connecting, fd, EV_FD_OUT, upstream_connected, NULL, 0, 0);
+		if (rc < 0) {
+			ev_timer_unref(federation.connect_timer);
+			federation.connect_timer = NULL;
+		}
+	}
+	if (rc < 0) {
+		LIBAFB_ERROR("can't wait the connection to the parent supervisor %s", federation.upstream);
+		close(fd);
+		upstream_retry();
+	}
+}
+
+int afs_federation_upstream(const char *uri, const char *node, struct afb_apiset *apiset)
+{
+	char host[64];
+
+	if (!node) {
+		if (gethostname(host, sizeof host) < 0)
+			return -errno;
+		host[sizeof host - 1] = 0;
+		node = host;
+	}
+	if (!*node || strchr(node, '/') || strlen(node) >= sizeof ((struct afb_supervisor_initiator*)0)->extra)
+		return X_EINVAL;
+	federation.upstream = strdup(uri);
+	federation.node = strdup(node);
+	if (!federation.upstream || !federation.node)
+		return X_ENOMEM;
+	federation.exported = apiset;
+	upstream_connect();
+	return 0;
+}
+
+/*************************************************************************************/
+/* PARENT SIDE                                                                       */
+/*************************************************************************************/
+
+static struct node *node_addref(struct node *node)
+{
+	x_mutex_lock(&federation.mutex);
+	node->refcount++;
+	x_mutex_unlock(&federation.mutex);
+	return node;
+}
+
+static void node_unref(struct node *node)
+{
+	unsigned refcount;
+
+	x_mutex_lock(&federation.mutex);
+	refcount = --node->refcount;
+	x_mutex_unlock(&federation.mutex);
+	if (!refcount) {
+		afb_evt_listener_unref(node->listener);
+		afb_stub_ws_unref(node->stub);
+		json_object_put(node->list);
+		free(node);
+	}
+}
+
+/* search the node of 'name' of length 'len', federation.mutex held */
+static struct node *search_locked(const char *name, size_t len)
+{
+	struct node *node;
+
+	for (node = federation.nodes ; node ; node = node->next)
+		if (!strncmp(node->name, name, len) && !node->name[len])
+			break;
+	return node;
+}
+
+/* get the item of 'key' of 'object' or NULL */
+static struct json_object *field(struct json_object *object, const char *key)
+{
+	struct json_object *item;
+
+	return json_object_object_get_ex(object, key, &item) ? item : NULL;
+}
+
+static void on_synced(void *closure, int status, unsigned nreplies, struct afb_data * const replies[]);
+
+/*
+ * resynchronize the list of 'node', federation.mutex held
+ * it is done by calling changes-since of the child that replies
+ * the missing changes or a full snapshot
+ */
+static void resync_locked(struct node *node)
+{
+	struct json_object *args;
+	struct afb_data *data;
+
+	if (node->syncing)
+		return;
+	args = json_object_new_object();
+	json_object_object_add(args, "generation", json_object_new_int64((int64_t)node->generation));
+	if (afb_json_legacy_make_data_json_c(&data, args) < 0)
+		return;
+	node->syncing = 1;
+	node->refcount++;
+	federation.resyncs++;
+	x_mutex_unlock(&federation.mutex);
+	afs_call(node->stub, "changes-since", 1, &data, NULL, NULL, on_synced, node);
+	x_mutex_lock(&federation.mutex);
+}
+
+/*
+ * make the item of the daemon 'pid' of a child
+ * the changes only give the pid of the daemons, so the lists of the
+ * children keep only it, even when synchronized from a full snapshot
+ */
+static struct json_object *pid_item(int pid)
+{
+	struct json_object *item;
+
+	item = json_object_new_object();
+	json_object_object_add(item, "pid", json_object_new_int(pid));
+	return item;
+}
+
+/* add ('add' not zero) or remove 'pid' of the list of 'node', federation.mutex held */
+static void change_locked(struct node *node, int add, int pid)
+{
+	char key[50];
+
+	sprintf(key, "%d", pid);
+	if (!add)
+		json_object_object_del(node->list, key);
+	else if (!json_object_object_get_ex(node->list, key, NULL))
+		json_object_object_add(node->list, key, pid_item(pid));
+	federation.deltas++;
+}
+
+/*
+ * apply to 'node' the 'change' (generation, op, pid), federation.mutex held
+ * return 0 on success or -1 when changes are missing
+ */
+static int apply_locked(struct node *node, struct json_object *change)
+{
+	uint64_t generation;
+
+	generation = (uint64_t)json_object_get_int64(field(change, "generation"));
+	if (generation <= node->generation)
+		return 0;
+	if (generation != node->generation + 1)
+		return -1;
+	change_locked(node,
+		!strcmp(json_object_get_string(field(change, "op")) ?: "", "add"),
+		json_object_get_int(field(change, "pid")));
+	node->generation = generation;
+	return 0;
+}
+
+/* apply to 'node' the pids of 'array' as added or removed, federation.mutex held */
+static void apply_pids_locked(struct node *node, struct json_object *array, int add)
+{
+	size_t i, n;
+
+	n = json_object_array_length(array);
+	for (i = 0 ; i < n ; i++)
+		change_locked(node, add, json_object_get_int(json_object_array_get_idx(array, i)));
+}
+
+static void on_synced_json(void *closure, struct json_object *object, const char *error, const char *info)
+{
+	struct node *node = closure;
+	struct json_object *list, *changes, *item;
+	size_t i, n;
+	int pid;
+
+	x_mutex_lock(&federation.mutex);
+	node->syncing = 0;
+	if (error)
+		LIBAFB_WARNING("can't synchronize the node %s: %s", node->name, error);
+	else if (json_object_object_get_ex(object, "list", &list)) {
+		/* a full snapshot, reduced to the pids as the changes */
+		json_object_put(node->list);
+		node->list = json_object_new_object();
+		json_object_object_foreach(list, key, value) {
+			(void)value;
+			pid = atoi(key);
+			if (pid > 0)
+				json_object_object_add(node->list, key, pid_item(pid));
+		}
+		json_object_object_get_ex(object, "generation", &item);
+		node->generation = (uint64_t)json_object_get_int64(item);
+	}
+	else if (json_object_object_get_ex(object, "changes", &changes)) {
+		/* the missing changes */
+		n = json_object_array_length(changes);
+		for (i = 0 ; i < n ; i++)
+			apply_locked(node, json_object_array_get_idx(changes, i));
+	}
+	x_mutex_unlock(&federation.mutex);
+}
+
+static void on_synced(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	struct node *node = closure;
+
+	afb_json_legacy_do_reply_json_c(node, status, nreplies, replies, on_synced_json);
+	node_unref(node);
+}
+
+/* a change pushed by a child */
+struct delta
+{
+	/* the node */
+	struct node *node;
+
+	/* name of the event */
+	const char *name;
+};
+
+static void on_delta(void *closure, struct json_object *object)
+{
+	struct delta *delta = closure;
+	struct node *node = delta->node;
+	uint64_t generation;
+
+	generation = (uint64_t)json_object_get_int64(field(object, "generation"));
+	x_mutex_lock(&federation.mutex);
+	if (node->syncing || generation <= node->generation)
+		; /* already known or soon resynchronized */
+	else if (!strcmp(delta->name, "changed")) {
+		if (apply_locked(node, object) < 0)
+			resync_locked(node);
+	}
+	else if (!strcmp(delta->name, "pids")) {
+		if ((uint64_t)json_object_get_int64(field(object, "since")) != node->generation)
+			resync_locked(node);
+		else {
+			/* the changes of the window are merged, apply them as one */
+			apply_pids_locked(node, field(object, "del"), 0);
+			apply_pids_locked(node, field(object, "add"), 1);
+			node->generation = generation;
+		}
+	}
+	x_mutex_unlock(&federation.mutex);
+}
+
+static void delta_push(void *closure, const struct afb_evt_pushed *event)
+{
+	struct delta delta;
+	const char *name;
+
+	name = strrchr(event->data.name, '/');
+	delta.node = closure;
+	delta.name = name ? name + 1 : event->data.name;
+	afb_json_legacy_do_single_json_c(event->data.nparams, event->data.params, on_delta, &delta);
+}
+
+static void delta_broadcast(void *closure, const struct afb_evt_broadcasted *event)
+{
+}
+
+static void delta_add(void *closure, const char *event, uint16_t evtid)
+{
+}
+
+static void delta_remove(void *closure, const char *event, uint16_t evtid)
+{
+}
+
+/* interface of the listeners of the changes of children */
+static const struct afb_evt_itf delta_itf =
+{
+	.push = delta_push,
+	.broadcast = delta_broadcast,
+	.add = delta_add,
+	.remove = delta_remove
+};
+
+static void node_hangup(struct afb_stub_ws *stub)
+{
+	struct node *node, **prv;
+
+	x_mutex_lock(&federation.mutex);
+	prv = &federation.nodes;
+	while ((node = *prv) && node->stub != stub)
+		prv = &node->next;
+	if (node)
+		*prv = node->next;
+	x_mutex_unlock(&federation.mutex);
+
+	if (!node)
+		afb_stub_ws_unref(stub);
+	else {
+		LIBAFB_NOTICE("child supervisor %s disconnected", node->name);
+		node_unref(node);
+	}
+}
+
+/*
+ * accept the child supervisor connected on 'fd' that sent 'asi'
+ * return 1 if accepted or 0 otherwise
+ */
+static int accept_node(int fd, struct afb_supervisor_initiator *asi)
+{
+	struct afb_data *data;
+	struct json_object *args;
+	struct node *node;
+	size_t len;
+
+	/* check the initiator */
+	if (strncmp(asi->interface, FEDERATION_INTERFACE, sizeof asi->interface)) {
+		LIBAFB_WARNING("rejecting a child supervisor: bad initiator");
+		return 0;
+	}
+	asi->extra[sizeof asi->extra - 1] = 0;
+	len = strlen(asi->extra);
+	if (!len || strchr(asi->extra, '/') || !strcmp(asi->extra, "*") || !strcmp(asi->extra, "all")) {
+		LIBAFB_WARNING("rejecting a child supervisor: bad name %s", asi->extra);
+		return 0;
+	}
+
+	/* create the node */
+	node = calloc(1, sizeof *node + len + 1);
+	if (!node)
+		return 0;
+	memcpy(node->name, asi->extra, len + 1);
+	node->list = json_object_new_object();
+	node->listener = afb_evt_listener_create(&delta_itf, node, NULL);
+	node->stub = node->listener ? afb_stub_ws_create_client(fd, 1, AFB_SUPERVISOR_APINAME, federation.apiset) : NULL;
+	if (!node->stub) {
+		if (node->listener)
+			afb_evt_listener_unref(node->listener);
+		json_object_put(node->list);
+		free(node);
+		return 0;
+	}
+	node->refcount = 2; /* the federation and the subscription */
+	node->syncing = 1;
+
+	/* link it if its name is free */
+	x_mutex_lock(&federation.mutex);
+	if (search_locked(node->name, len)) {
+		x_mutex_unlock(&federation.mutex);
+		LIBAFB_WARNING("rejecting a child supervisor: duplicate name %s", node->name);
+		node->refcount = 1;
+		node_unref(node);
+		return 1;
+	}
+	node->next = federation.nodes;
+	federation.nodes = node;
+	x_mutex_unlock(&federation.mutex);
+	afb_stub_ws_set_on_hangup(node->stub, node_hangup);
+	LIBAFB_NOTICE("child supervisor %s registered", node->name);
+
+	/* subscribe to its changes, the reply gives its list */
+	args = json_object_new_object();
+	json_object_object_add(args, "changes", json_object_new_boolean(1));
+	if (afb_json_legacy_make_data_json_c(&data, args) < 0) {
+		on_synced(node, X_ENOMEM, 0, NULL);
+		return 1;
+	}
+	afs_call(node->stub, "subscribe", 1, &data, NULL, node->listener, on_synced, node);
+	return 1;
+}
+
+/* stop waiting the initiator of 'newcomer' */
+static void newcomer_release(struct newcomer *newcomer)
+{
+	ev_timer_unref(newcomer->timer);
+	ev_fd_unref(newcomer->efd);
+	free(newcomer);
+}
+
+/*
+ * check that the peer of 'fd' runs with the uid of the supervisor (or root)
+ * return 1 if allowed or 0 otherwise
+ */
+static int peer_allowed(int fd)
+{
+	struct ucred ucred;
+	socklen_t len;
+
+	len = sizeof ucred;
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &len) < 0) {
+		LIBAFB_WARNING("rejecting a child supervisor: no credentials");
+		return 0;
+	}
+	if (ucred.uid != getuid() && ucred.uid != 0) {
+		LIBAFB_WARNING("rejecting a child supervisor: uid %d not allowed", (int)ucred.uid);
+		return 0;
+	}
+	return 1;
+}
+
+/* the initiator of a newcomer is readable */
+static void newcomer_initiating(struct ev_fd *efd, int fd, uint32_t revents, void *closure)
+{
+	struct afb_supervisor_initiator asi;
+	ssize_t rc;
+
+	rc = (revents & EV_FD_IN) ? read(fd, &asi, sizeof asi) : 0;
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	newcomer_release(closure);
+	if (rc != (ssize_t)sizeof asi) {
+		LIBAFB_WARNING("rejecting a child supervisor: bad initiator");
+		close(fd);
+	}
+	else if (!accept_node(fd, &asi))
+		close(fd);
+}
+
+/* the initiator of a newcomer did not come in time */
+static void newcomer_expired(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	struct newcomer *newcomer = closure;
+	int fd;
+
+	LIBAFB_WARNING("rejecting a child supervisor: no initiator");
+	fd = ev_fd_fd(newcomer->efd);
+	newcomer_release(newcomer);
+	close(fd);
+}
+
+/*
+ * wait without blocking the initiator of the child supervisor connected on 'fd'
+ * return 0 on success or a negative error code
+ */
+static int newcomer_wait(int fd)
+{
+	struct newcomer *newcomer;
+	int rc;
+
+	newcomer = calloc(1, sizeof *newcomer);
+	if (!newcomer)
+		return X_ENOMEM;
+	rc = afb_ev_mgr_add_timer(&newcomer->timer, 0,
+			INITIATOR_TIMEOUT_MS / 1000, INITIATOR_TIMEOUT_MS % 1000,
+			1, 0, INITIATOR_TIMEOUT_MS / 10, newcomer_expired, newcomer, 0);
+	if (rc >= 0) {
+		rc = afb_ev_mgr_add_fd(&newcomer->efd, fd, EV_FD_IN, newcomer_initiating, newcomer, 0, 0);
+		if (rc >= 0)
+			return 0;
+		ev_timer_unref(newcomer->timer);
+	}
+	free(newcomer);
+	return rc;
+}
+
+static void listening(struct ev_fd *efd, int fd, uint32_t revents, void *closure)
+{
+	int sock;
+
+	if ((revents & EV_FD_IN) == 0)
+		return;
+	for (;;) {
+		sock = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (sock < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LIBAFB_ERROR("can't accept child supervisor: %s", strerror(errno));
+			break;
+		}
+		if (!peer_allowed(sock))
+			close(sock);
+		else if (newcomer_wait(sock) < 0) {
+			LIBAFB_ERROR("can't wait the initiator of a child supervisor");
+			close(sock);
+		}
+	}
+}
+
+int afs_federation_listen(const char *uri)
+{
+	int fd, rc;
+
+	if (!federation.apiset) {
+		federation.apiset = afb_apiset_create("federation", 0);
+		if (!federation.apiset)
+			return X_ENOMEM;
+	}
+	fd = afb_socket_open(uri, 1);
+	if (fd < 0)
+		return fd;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	rc = afb_ev_mgr_add_fd(&federation.efd, fd, EV_FD_IN, listening, 0, 0, 1);
+	if (rc < 0)
+		close(fd);
+	return rc;
+}
+
+/*************************************************************************************/
+/* ROUTING                                                                           */
+/*************************************************************************************/
+
+/* release a pending count of 'fedout', replying when it was the last */
+static void fedout_release(struct fedout *fedout)
+{
+	unsigned pending;
+
+	x_mutex_lock(&fedout->mutex);
+	pending = --fedout->pending;
+	x_mutex_unlock(&fedout->mutex);
+
+	if (!pending) {
+		afb_json_legacy_req_reply_hookable(fedout->req, fedout->result, NULL, NULL);
+		afb_req_common_unref(fedout->req);
+		free(fedout);
+	}
+}
+
+/* add to 'fedout' the reply of the node 'name' and release its pending count */
+static void fedout_add(struct fedout *fedout, const char *name, struct json_object *object, const char *error, const char *info)
+{
+	struct json_object *item;
+
+	item = json_object_new_object();
+	json_object_object_add(item, "status", json_object_new_string(error ?: "success"));
+	if (info)
+		json_object_object_add(item, "info", json_object_new_string(info));
+	if (object)
+		json_object_object_add(item, "response", json_object_get(object));
+
+	x_mutex_lock(&fedout->mutex);
+	json_object_object_add(fedout->result, name, item);
+	x_mutex_unlock(&fedout->mutex);
+	fedout_release(fedout);
+}
+
+static void fedout_on_json_reply(void *closure, struct json_object *object, const char *error, const char *info)
+{
+	struct fedcall *call = closure;
+
+	fedout_add(call->fedout, call->name, object, error, info);
+}
+
+static void fedout_on_reply(void *closure, int status, unsigned nreplies, struct afb_data * const replies[])
+{
+	struct fedcall *call = closure;
+
+	afb_json_legacy_do_reply_json_c(call, status, nreplies, replies, fedout_on_json_reply);
+	free(call);
+}
+
+/*
+ * forwards the request 'req' of arguments 'args' to all the nodes
+ * the replies are aggregated in one object keyed by node
+ * the local daemons are not part of it: it is not a subtree answer
+ */
+static void route_all(struct afb_req_common *req, struct json_object *args)
+{
+	struct node *node, **nodes;
+	struct fedout *fedout;
+	struct fedcall *call;
+	struct afb_data *data;
+	unsigned i, count;
+
+	/* snapshot the nodes */
+	x_mutex_lock(&federation.mutex);
+	for (count = 0, node = federation.nodes ; node ; node = node->next)
+		count++;
+	nodes = malloc((count ?: 1) * sizeof *nodes);
+	fedout = nodes ? malloc(sizeof *fedout) : NULL;
+	if (fedout)
+		for (i = 0, node = federation.nodes ; node ; node = node->next, i++) {
+			node->refcount++;
+			nodes[i] = node;
+		}
+	x_mutex_unlock(&federation.mutex);
+	if (!fedout) {
+		free(nodes);
+		afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+		return;
+	}
+
+	x_mutex_init(&fedout->mutex);
+	fedout->pending = count + 1;
+	fedout->req = afb_req_common_addref(req);
+	fedout->result = json_object_new_object();
+	for (i = 0 ; i < count ; i++) {
+		node = nodes[i];
+		call = malloc(sizeof *call + strlen(node->name) + 1);
+		if (!call)
+			fedout_add(fedout, node->name, NULL, "internal-error", NULL);
+		else {
+			call->fedout = fedout;
+			strcpy(call->name, node->name);
+			if (afb_json_legacy_make_data_json_c(&data, json_object_get(args)) < 0)
+				fedout_on_reply(call, X_ENOMEM, 0, NULL);
+			else
+				afs_call_as(node->stub, req->verbname, 1, &data, req, NULL, fedout_on_reply, call);
+		}
+		node_unref(node);
+	}
+	free(nodes);
+
+	/* release the initial count */
+	fedout_release(fedout);
+}
+
+int afs_federation_route(struct afb_req_common *req, struct json_object *args)
+{
+	struct json_object *item;
+	struct afb_data *data;
+	struct node *node;
+	const char *path, *rest;
+	size_t len;
+
+	if (!json_object_object_get_ex(args, "node", &item))
+		return 0;
+	if (!json_object_is_type(item, json_type_string)) {
+		afb_json_legacy_req_reply_hookable(req, NULL, "bad-node", NULL);
+		return 1;
+	}
+
+	/* split the path: the first node and the rest for it */
+	path = json_object_get_string(item);
+	len = strcspn(path, "/");
+	rest = path[len] ? &path[len + 1] : NULL;
+	if ((len == 1 && path[0] == '*') || (len == 3 && !strncmp(path, "all", 3)))
+		node = NULL;
+	else {
+		x_mutex_lock(&federation.mutex);
+		node = search_locked(path, len);
+		if (node)
+			node->refcount++;
+		x_mutex_unlock(&federation.mutex);
+		if (!node) {
+			afb_json_legacy_req_reply_hookable(req, NULL, "unknown-node", NULL);
+			return 1;
+		}
+	}
+	if (rest)
+		json_object_object_add(args, "node", json_object_new_string(rest));
+	else
+		json_object_object_del(args, "node");
+
+	if (!node)
+		route_all(req, args);
+	else {
+		if (afb_json_legacy_make_data_json_c(&data, json_object_get(args)) < 0)
+			afb_json_legacy_req_reply_hookable(req, NULL, "internal-error", NULL);
+		else
+			afs_call(node->stub, req->verbname, 1, &data, req, NULL, NULL, NULL);
+		node_unref(node);
+	}
+	return 1;
+}
+
+void afs_federation_list(struct json_object *list)
+{
+	struct node *node;
+	char *key;
+
+	x_mutex_lock(&federation.mutex);
+	for (node = federation.nodes ; node ; node = node->next) {
+		json_object_object_foreach(node->list, pid, item) {
+			if (asprintf(&key, "%s/%s", node->name, pid) >= 0) {
+				json_object_object_add(list, key, json_object_get(item));
+				free(key);
+			}
+		}
+	}
+	x_mutex_unlock(&federation.mutex);
+}
+
+void afs_federation_counters(struct json_object *resu)
+{
+	struct json_object *item;
+	struct node *node;
+	int nodes, daemons;
+
+	item = json_object_new_object();
+	x_mutex_lock(&federation.mutex);
+	nodes = daemons = 0;
+	for (node = federation.nodes ; node ; node = node->next) {
+		nodes++;
+		daemons += json_object_object_length(node->list);
+	}
+	json_object_object_add(item, "nodes", json_object_new_int(nodes));
+	json_object_object_add(item, "daemons", json_object_new_int(daemons));
+	json_object_object_add(item, "deltas", json_object_new_int64((int64_t)federation.deltas));
+	json_object_object_add(item, "resyncs", json_object_new_int64((int64_t)federation.resyncs));
+	json_object_object_add(item, "upstream", json_object_new_boolean(federation.up != NULL));
+	x_mutex_unlock(&federation.mutex);
+	json_object_object_add(resu, "federation", item);
+}
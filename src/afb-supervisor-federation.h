@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+struct afb_apiset;
+struct afb_req_common;
+struct json_object;
+
+/**
+ * Listens on 'uri' the registration of child supervisors
+ * Returns 0 on success or a negative error code
+ */
+extern int afs_federation_listen(const char *uri);
+
+/**
+ * Registers with the parent supervisor listening on 'uri' as the
+ * node 'node' (the host name if NULL), serving to it the supervisor
+ * api of 'apiset'. The registration is retried while it fails and
+ * after each disconnection.
+ * Returns 0 on success or a negative error code
+ */
+extern int afs_federation_upstream(const char *uri, const char *node, struct afb_apiset *apiset);
+
+/**
+ * Routes the request 'req' of arguments 'args' to the child supervisors
+ * when 'args' has a "node" field: a name, a path of names separated by
+ * slashes or "*" (or "all") for all the children, the supervisor
+ * itself being excluded.
+ * Returns 1 if the request was routed (and replied) or 0 otherwise.
+ */
+extern int afs_federation_route(struct afb_req_common *req, struct json_object *args);
+
+/**
+ * Adds to 'list' the daemons of the child supervisors keyed by "node/pid",
+ * their items only giving their pid (not their credentials)
+ */
+extern void afs_federation_list(struct json_object *list);
+
+/**
+ * Adds to 'resu' the counters of the federation
+ */
+extern void afs_federation_counters(struct json_object *resu);
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <libafb/misc/afb-verbose.h>
+#include <libafb/sys/x-errno.h>
+
+#include "afb-supervisor-handoff.h"
+
+/* first file descriptor passed by the protocol of LISTEN_FDS */
+#define HANDOFF_FDS_START 3
+
+/* the handoff state */
+static struct {
+	/* path of the executable, resolved at start */
+	char *exe;
+
+	/* the arguments of the program */
+	char **av;
+
+	/* count of inherited file descriptors */
+	unsigned count;
+
+	/* the inherited file descriptors */
+	int *fds;
+
+	/* names of the inherited file descriptors */
+	char **names;
+}
+	handoff;
+
+/* read the inherited file descriptors from the environment */
+static void get_inherited(void)
+{
+	const char *pid, *fds, *names;
+	char *end;
+	unsigned i;
+	long n;
+	size_t len;
+
+	pid = getenv("LISTEN_PID");
+	fds = getenv("LISTEN_FDS");
+	if (!pid || !fds || strtol(pid, NULL, 10) != (long)getpid())
+		return;
+	n = strtol(fds, &end, 10);
+	if (*end || n <= 0 || n > INT_MAX - HANDOFF_FDS_START)
+		return;
+
+	handoff.fds = calloc((size_t)n, sizeof *handoff.fds);
+	handoff.names = calloc((size_t)n, sizeof *handoff.names);
+	if (!handoff.fds || !handoff.names) {
+		LIBAFB_ERROR("out of memory, inherited file descriptors ignored");
+		return;
+	}
+	names = getenv("LISTEN_FDNAMES");
+	for (i = 0 ; i < (unsigned)n ; i++) {
+		handoff.fds[i] = HANDOFF_FDS_START + (int)i;
+		len = names ? strcspn(names, ":") : 0;
+		handoff.names[i] = len ? strndup(names, len) : strdup("unknown");
+		if (names)
+			names = names[len] ? &names[len + 1] : NULL;
+	}
+	handoff.count = (unsigned)n;
+}
+
+void afs_handoff_init(int ac, char **av)
+{
+	int i;
+
+	handoff.exe = realpath("/proc/self/exe", NULL);
+	handoff.av = calloc((size_t)ac + 1, sizeof *handoff.av);
+	if (handoff.av)
+		for (i = 0 ; i < ac ; i++)
+			handoff.av[i] = strdup(av[i]);
+	get_inherited();
+}
+
+int afs_handoff_inherited(const char *name)
+{
+	unsigned i;
+
+	for (i = 0 ; i < handoff.count ; i++)
+		if (handoff.names[i] && !strcmp(handoff.names[i], name))
+			return handoff.fds[i];
+	return -1;
+}
+
+/* is 'fd' in the 'count' descriptors of 'fds'? */
+static int has_fd(unsigned count, const int fds[], int fd)
+{
+	while (count)
+		if (fds[--count] == fd)
+			return 1;
+	return 0;
+}
+
+int afs_handoff_exec(unsigned count, const int fds[], const char * const names[])
+{
+	unsigned i, n;
+	int *tmps, rc;
+	const char **allnames;
+	char *joined, *iter, text[20];
+	size_t size;
+
+	if (!handoff.exe || !handoff.av || !handoff.av[0])
+		return X_ENOMEM;
+	if (access(handoff.exe, X_OK) < 0)
+		return -errno;
+
+	/* gather the descriptors and the inherited ones */
+	n = count;
+	for (i = 0 ; i < handoff.count ; i++)
+		n += !has_fd(count, fds, handoff.fds[i]);
+	tmps = malloc(n * sizeof *tmps);
+	allnames = malloc(n * sizeof *allnames);
+	if (!tmps || !allnames) {
+		free(tmps);
+		free(allnames);
+		return X_ENOMEM;
+	}
+	for (n = 0 ; n < count ; n++) {
+		tmps[n] = fds[n];
+		allnames[n] = names[n];
+	}
+	for (i = 0 ; i < handoff.count ; i++)
+		if (!has_fd(count, fds, handoff.fds[i])) {
+			tmps[n] = handoff.fds[i];
+			allnames[n++] = handoff.names[i];
+		}
+
+	/* join the names */
+	size = 1;
+	for (i = 0 ; i < n ; i++)
+		size += strlen(allnames[i]) + 1;
+	joined = iter = malloc(size);
+	if (!joined) {
+		free(tmps);
+		free(allnames);
+		return X_ENOMEM;
+	}
+	*iter = 0;
+	for (i = 0 ; i < n ; i++) {
+		if (i)
+			*iter++ = ':';
+		iter = stpcpy(iter, allnames[i]);
+	}
+
+	/* move the descriptors above their final place */
+	for (i = 0 ; i < n ; i++) {
+		rc = fcntl(tmps[i], F_DUPFD_CLOEXEC, HANDOFF_FDS_START + (int)n);
+		if (rc < 0) {
+			rc = -errno;
+			while (i)
+				close(tmps[--i]);
+			free(tmps);
+			free(allnames);
+			free(joined);
+			return rc;
+		}
+		tmps[i] = rc;
+	}
+
+	/* set the environment */
+	snprintf(text, sizeof text, "%u", n);
+	rc = setenv("LISTEN_FDS", text, 1);
+	if (rc == 0) {
+		snprintf(text, sizeof text, "%ld", (long)getpid());
+		rc = setenv("LISTEN_PID", text, 1);
+	}
+	if (rc == 0)
+		rc = setenv("LISTEN_FDNAMES", joined, 1);
+	if (rc < 0) {
+		rc = -errno;
+		for (i = 0 ; i < n ; i++)
+			close(tmps[i]);
+		free(tmps);
+		free(allnames);
+		free(joined);
+		return rc;
+	}
+
+	/* no way back: place the descriptors and exec */
+	for (i = 0 ; i < n ; i++) {
+		dup2(tmps[i], HANDOFF_FDS_START + (int)i);
+		close(tmps[i]);
+	}
+	execv(handoff.exe, handoff.av);
+	LIBAFB_ERROR("handoff to %s failed: %s", handoff.exe, strerror(errno));
+	exit(1);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+/* name of the handed off listening socket of the supervision */
+#define AFS_HANDOFF_LISTENER "supervision"
+
+/**
+ * Records the arguments 'ac' and 'av' of the program for its next exec
+ * and the file descriptors inherited through LISTEN_FDS
+ */
+extern void afs_handoff_init(int ac, char **av);
+
+/**
+ * Returns the inherited file descriptor named 'name' or -1 if none
+ */
+extern int afs_handoff_inherited(const char *name);
+
+/**
+ * Replaces the program by a fresh exec of itself inheriting the
+ * 'count' file descriptors 'fds' of names 'names' and the inherited
+ * descriptors, using the protocol of LISTEN_FDS.
+ * Returns a negative error code when the exec can't be prepared.
+ * Doesn't return when the exec is done and exits when it fails late.
+ */
+extern int afs_handoff_exec(unsigned count, const int fds[], const char * const names[]);
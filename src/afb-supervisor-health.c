@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <json-c/json.h>
+
+#include <libafb/sys/x-mutex.h>
+
+#include "afb-supervisor-histo.h"
+#include "afb-supervisor-health.h"
+
+/* count of buckets of pids (must be a power of 2) */
+#define HEALTH_BUCKETS 64
+
+/* weight of new round-trips in the moving average is 1/2^HEALTH_EWMA_SHIFT */
+#define HEALTH_EWMA_SHIFT 3
+
+/* health of a daemon */
+struct daemon
+{
+	/* next of the bucket */
+	struct daemon *next;
+
+	/* pid of the daemon */
+	int pid;
+
+	/* is the probe in flight stalled? */
+	int stalled;
+
+	/* time in us of the next probe */
+	uint64_t next_us;
+
+	/* time in us of the probe in flight or 0 */
+	uint64_t sent_us;
+
+	/* count of probes and of failed probes */
+	uint64_t probes;
+	uint64_t failures;
+
+	/* count of stalls */
+	uint64_t stalls;
+
+	/* moving average of the round-trips in us */
+	uint64_t ewma_us;
+
+	/* round-trips in us */
+	struct afs_histo rtt;
+};
+
+/* the health of the daemons */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* period of the probes in us, 0 when not probing */
+	uint64_t period_us;
+
+	/* time in us without reply making a probe stalled */
+	uint64_t stall_us;
+
+	/* the daemons */
+	struct daemon *buckets[HEALTH_BUCKETS];
+}
+	health = { .mutex = X_MUTEX_INITIALIZER };
+
+void afs_health_configure(unsigned period_ms, unsigned stall_ms)
+{
+	x_mutex_lock(&health.mutex);
+	health.period_us = (uint64_t)period_ms * 1000;
+	health.stall_us = (uint64_t)stall_ms * 1000;
+	x_mutex_unlock(&health.mutex);
+}
+
+void afs_health_track(int pid, uint64_t now_us)
+{
+	struct daemon *d, **pd;
+
+	x_mutex_lock(&health.mutex);
+	if (health.period_us) {
+		pd = &health.buckets[(unsigned)pid & (HEALTH_BUCKETS - 1)];
+		d = *pd;
+		while (d && d->pid != pid)
+			d = d->next;
+		if (!d) {
+			d = calloc(1, sizeof *d);
+			if (d) {
+				d->pid = pid;
+				d->next = *pd;
+				*pd = d;
+			}
+		}
+		if (d) {
+			/* spread the probes over the period */
+			d->next_us = now_us + ((unsigned)pid * 2654435761U) % health.period_us;
+			d->sent_us = 0;
+			d->stalled = 0;
+		}
+	}
+	x_mutex_unlock(&health.mutex);
+}
+
+void afs_health_forget(int pid)
+{
+	struct daemon *d, **pd;
+
+	x_mutex_lock(&health.mutex);
+	pd = &health.buckets[(unsigned)pid & (HEALTH_BUCKETS - 1)];
+	while ((d = *pd) && d->pid != pid)
+		pd = &d->next;
+	if (d) {
+		*pd = d->next;
+		free(d);
+	}
+	x_mutex_unlock(&health.mutex);
+}
+
+unsigned afs_health_due(uint64_t now_us, int pids[], unsigned max)
+{
+	struct daemon *d;
+	unsigned i, n;
+
+	n = 0;
+	x_mutex_lock(&health.mutex);
+	for (i = 0 ; i < HEALTH_BUCKETS && n < max ; i++)
+		for (d = health.buckets[i] ; d && n < max ; d = d->next)
+			if (!d->sent_us && d->next_us <= now_us) {
+				d->sent_us = now_us;
+				d->next_us += health.period_us;
+				if (d->next_us <= now_us)
+					d->next_us = now_us + health.period_us;
+				d->probes++;
+				pids[n++] = d->pid;
+			}
+	x_mutex_unlock(&health.mutex);
+	return n;
+}
+
+uint64_t afs_health_reply(int pid, int status, uint64_t now_us)
+{
+	struct daemon *d;
+	uint64_t rtt, recovered;
+
+	recovered = 0;
+	x_mutex_lock(&health.mutex);
+	d = health.buckets[(unsigned)pid & (HEALTH_BUCKETS - 1)];
+	while (d && d->pid != pid)
+		d = d->next;
+	if (d && d->sent_us) {
+		rtt = now_us - d->sent_us;
+		if (status < 0)
+			d->failures++;
+		else {
+			afs_histo_add(&d->rtt, rtt);
+			if (d->ewma_us)
+				d->ewma_us = d->ewma_us - (d->ewma_us >> HEALTH_EWMA_SHIFT) + (rtt >> HEALTH_EWMA_SHIFT);
+			else
+				d->ewma_us = rtt;
+		}
+		if (d->stalled)
+			recovered = rtt ?: 1;
+		d->sent_us = 0;
+		d->stalled = 0;
+	}
+	x_mutex_unlock(&health.mutex);
+	return recovered;
+}
+
+unsigned afs_health_stalls(uint64_t now_us, int pids[], unsigned max)
+{
+	struct daemon *d;
+	unsigned i, n;
+
+	n = 0;
+	x_mutex_lock(&health.mutex);
+	for (i = 0 ; i < HEALTH_BUCKETS && n < max ; i++)
+		for (d = health.buckets[i] ; d && n < max ; d = d->next)
+			if (d->sent_us && !d->stalled && now_us - d->sent_us >= health.stall_us) {
+				d->stalled = 1;
+				d->stalls++;
+				pids[n++] = d->pid;
+			}
+	x_mutex_unlock(&health.mutex);
+	return n;
+}
+
+struct json_object *afs_health_query(struct json_object *filter)
+{
+	struct json_object *result, *item;
+	struct daemon *d;
+	unsigned i;
+	int pid;
+	char spid[20];
+
+	pid = json_object_is_type(filter, json_type_object)
+		&& json_object_object_get_ex(filter, "pid", &item) ? json_object_get_int(item) : 0;
+
+	result = json_object_new_object();
+	x_mutex_lock(&health.mutex);
+	for (i = 0 ; i < HEALTH_BUCKETS ; i++) {
+		for (d = health.buckets[i] ; d ; d = d->next) {
+			if (!pid || pid == d->pid) {
+				item = json_object_new_object();
+				json_object_object_add(item, "probes", json_object_new_int64((int64_t)d->probes));
+				json_object_object_add(item, "failures", json_object_new_int64((int64_t)d->failures));
+				json_object_object_add(item, "stalls", json_object_new_int64((int64_t)d->stalls));
+				json_object_object_add(item, "stalled", json_object_new_boolean(d->stalled));
+				json_object_object_add(item, "ewma", json_object_new_int64((int64_t)d->ewma_us));
+				json_object_object_add(item, "rtt", afs_histo_json(&d->rtt));
+				snprintf(spid, sizeof spid, "%d", d->pid);
+				json_object_object_add(result, spid, item);
+			}
+		}
+	}
+	x_mutex_unlock(&health.mutex);
+	return result;
+}
+
+void afs_health_print(FILE *file)
+{
+	struct daemon *d;
+	unsigned i;
+	char labels[20];
+
+	x_mutex_lock(&health.mutex);
+	fprintf(file, "# TYPE afb_supervisor_probe_stalled gauge\n");
+	for (i = 0 ; i < HEALTH_BUCKETS ; i++)
+		for (d = health.buckets[i] ; d ; d = d->next)
+			fprintf(file, "afb_supervisor_probe_stalled{pid=\"%d\"} %d\n", d->pid, d->stalled);
+	fprintf(file, "# TYPE afb_supervisor_probe_ewma_seconds gauge\n");
+	for (i = 0 ; i < HEALTH_BUCKETS ; i++)
+		for (d = health.buckets[i] ; d ; d = d->next)
+			fprintf(file, "afb_supervisor_probe_ewma_seconds{pid=\"%d\"} %g\n",
+				d->pid, (double)d->ewma_us / 1e6);
+	fprintf(file, "# TYPE afb_supervisor_probe_seconds summary\n");
+	for (i = 0 ; i < HEALTH_BUCKETS ; i++) {
+		for (d = health.buckets[i] ; d ; d = d->next) {
+			snprintf(labels, sizeof labels, "pid=\"%d\"", d->pid);
+			afs_histo_print(file, "afb_supervisor_probe_seconds", labels, &d->rtt);
+		}
+	}
+	x_mutex_unlock(&health.mutex);
+}
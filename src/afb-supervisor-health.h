@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct json_object;
+
+/**
+ * Sets the 'period_ms' of the probes of each daemon (0 for no probing)
+ * and the time 'stall_ms' after which a probe without reply is stalled
+ */
+extern void afs_health_configure(unsigned period_ms, unsigned stall_ms);
+
+/**
+ * Starts probing the daemon 'pid' at 'now_us', its first probe being
+ * delayed by a part of the period depending on 'pid' for spreading
+ * the probes of all daemons over the period
+ */
+extern void afs_health_track(int pid, uint64_t now_us);
+
+/**
+ * Forgets the daemon 'pid'
+ */
+extern void afs_health_forget(int pid);
+
+/**
+ * Gives in 'pids' at most 'max' daemons to probe at 'now_us' and
+ * records them as probed.
+ * Returns the count of pids given.
+ */
+extern unsigned afs_health_due(uint64_t now_us, int pids[], unsigned max);
+
+/**
+ * Records at 'now_us' the reply of 'status' of the daemon 'pid' to its probe
+ * Returns the round-trip in us if the daemon was stalled or 0 otherwise.
+ */
+extern uint64_t afs_health_reply(int pid, int status, uint64_t now_us);
+
+/**
+ * Gives in 'pids' at most 'max' daemons whose probe is stalled at
+ * 'now_us' and records them as stalled.
+ * Returns the count of pids given.
+ */
+extern unsigned afs_health_stalls(uint64_t now_us, int pids[], unsigned max);
+
+/**
+ * Returns a new object with the health of the daemons or of the
+ * daemon "pid" of 'filter'
+ */
+extern struct json_object *afs_health_query(struct json_object *filter);
+
+/**
+ * Prints to 'file' the round-trips of the probes and the stalls
+ * in the text exposition format of Prometheus
+ */
+extern void afs_health_print(FILE *file);
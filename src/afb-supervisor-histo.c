@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include "afb-supervisor-histo.h"
+
+/* count of sub-buckets per power of 2 */
+#define SUB (1U << AFS_HISTO_BITS)
+
+/* maximal recorded value */
+#define VALUE_MAX ((UINT64_C(1) << AFS_HISTO_LOG2_MAX) - 1)
+
+/* index of the bucket of 'value' */
+static unsigned bucket_of(uint64_t value)
+{
+	unsigned shift;
+
+	if (value < 2 * SUB)
+		return (unsigned)value;
+	shift = (unsigned)(63 - __builtin_clzll(value)) - AFS_HISTO_BITS;
+	return (shift + 1) * SUB + (unsigned)(value >> shift) - SUB;
+}
+
+/* highest value of the bucket of 'index' */
+static uint64_t bucket_high(unsigned index)
+{
+	unsigned shift;
+
+	if (index < 2 * SUB)
+		return index;
+	shift = index / SUB - 1;
+	return ((uint64_t)(index % SUB + SUB + 1) << shift) - 1;
+}
+
+void afs_histo_add(struct afs_histo *histo, uint64_t value)
+{
+	if (value > VALUE_MAX)
+		value = VALUE_MAX;
+	if (!histo->count || value < histo->min)
+		histo->min = value;
+	if (value > histo->max)
+		histo->max = value;
+	histo->count++;
+	histo->sum += value;
+	histo->buckets[bucket_of(value)]++;
+}
+
+uint64_t afs_histo_permil(const struct afs_histo *histo, unsigned permil)
+{
+	uint64_t rank, seen, high;
+	unsigned index;
+
+	if (!histo->count)
+		return 0;
+	rank = (histo->count * permil + 999) / 1000;
+	for (seen = 0, index = 0 ; index < AFS_HISTO_BUCKETS ; index++) {
+		seen += histo->buckets[index];
+		if (seen >= rank && seen) {
+			high = bucket_high(index);
+			return high < histo->max ? high : histo->max;
+		}
+	}
+	return histo->max;
+}
+
+struct json_object *afs_histo_json(const struct afs_histo *histo)
+{
+	struct json_object *obj;
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "count", json_object_new_int64((int64_t)histo->count));
+	json_object_object_add(obj, "min", json_object_new_int64((int64_t)histo->min));
+	json_object_object_add(obj, "mean", json_object_new_int64(
+			histo->count ? (int64_t)(histo->sum / histo->count) : 0));
+	json_object_object_add(obj, "max", json_object_new_int64((int64_t)histo->max));
+	json_object_object_add(obj, "p50", json_object_new_int64((int64_t)afs_histo_permil(histo, 500)));
+	json_object_object_add(obj, "p90", json_object_new_int64((int64_t)afs_histo_permil(histo, 900)));
+	json_object_object_add(obj, "p99", json_object_new_int64((int64_t)afs_histo_permil(histo, 990)));
+	json_object_object_add(obj, "p999", json_object_new_int64((int64_t)afs_histo_permil(histo, 999)));
+	return obj;
+}
+
+void afs_histo_print(FILE *file, const char *name, const char *labels, const struct afs_histo *histo)
+{
+	static const unsigned permils[] = { 500, 900, 990, 999 };
+	const char *sep = labels && *labels ? "," : "";
+	unsigned i;
+
+	labels = labels ?: "";
+	for (i = 0 ; i < sizeof permils / sizeof *permils ; i++)
+		fprintf(file, "%s{%s%squantile=\"%g\"} %g\n", name, labels, sep,
+			permils[i] / 1000.0, (double)afs_histo_permil(histo, permils[i]) / 1e6);
+	fprintf(file, "%s_sum{%s} %g\n", name, labels, (double)histo->sum / 1e6);
+	fprintf(file, "%s_count{%s} %llu\n", name, labels, (unsigned long long)histo->count);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct json_object;
+
+/* count of sub-buckets per power of 2 is 2^AFS_HISTO_BITS */
+#define AFS_HISTO_BITS 3
+
+/* values are clipped to 2^AFS_HISTO_LOG2_MAX - 1 */
+#define AFS_HISTO_LOG2_MAX 40
+
+/* count of buckets */
+#define AFS_HISTO_BUCKETS ((AFS_HISTO_LOG2_MAX - AFS_HISTO_BITS + 1) << AFS_HISTO_BITS)
+
+/**
+ * Histogram of fixed size with logarithmic buckets, each bucket
+ * having a width of at most 1/8 of its lower bound
+ */
+struct afs_histo
+{
+	/* count of values */
+	uint64_t count;
+
+	/* sum of the values */
+	uint64_t sum;
+
+	/* minimal value */
+	uint64_t min;
+
+	/* maximal value */
+	uint64_t max;
+
+	/* counts of values per bucket */
+	uint32_t buckets[AFS_HISTO_BUCKETS];
+};
+
+/**
+ * Adds the 'value' to the histogram 'histo'
+ */
+extern void afs_histo_add(struct afs_histo *histo, uint64_t value);
+
+/**
+ * Returns the value below which 'permil' per thousand of the values
+ * of 'histo' fall
+ */
+extern uint64_t afs_histo_permil(const struct afs_histo *histo, unsigned permil);
+
+/**
+ * Returns a new json object summarizing 'histo' with keys count,
+ * min, mean, max, p50, p90, p99 and p999
+ */
+extern struct json_object *afs_histo_json(const struct afs_histo *histo);
+
+/**
+ * Prints to 'file' the histogram 'histo' of durations in us as the
+ * summary 'name' in seconds, in the text exposition format of
+ * Prometheus, with the optional 'labels' (ex: pid="12")
+ */
+extern void afs_histo_print(FILE *file, const char *name, const char *labels, const struct afs_histo *histo);
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include <json-c/json.h>
+
+#include <libafb/sys/x-mutex.h>
+
+#include "afb-supervisor-histo.h"
+#include "afb-supervisor-metrics.h"
+
+/* maximal length of names of verbs */
+#define METRICS_NAME_MAX 32
+
+/* maximal count of recorded verbs */
+#define METRICS_VERBS_MAX 64
+
+/* count of buckets of pids (must be a power of 2) */
+#define METRICS_BUCKETS 64
+
+/* metrics of a verb of the supervisor */
+struct verb
+{
+	/* next verb */
+	struct verb *next;
+
+	/* count of requests */
+	uint64_t count;
+
+	/* durations in us from reception to authorization */
+	struct afs_histo auth;
+
+	/* durations in us from authorization to the end of the handling */
+	struct afs_histo handle;
+
+	/* durations in us from forwarding to reply by daemons */
+	struct afs_histo daemon;
+
+	/* name of the verb */
+	char name[METRICS_NAME_MAX];
+};
+
+/* metrics of a supervised daemon */
+struct daemon
+{
+	/* next of the bucket */
+	struct daemon *next;
+
+	/* pid of the daemon */
+	int pid;
+
+	/* count of requests currently forwarded */
+	unsigned inflight;
+
+	/* count of forwarded requests */
+	uint64_t forwarded;
+
+	/* count of error replies */
+	uint64_t errors;
+
+	/* durations in us from forwarding to reply */
+	struct afs_histo roundtrip;
+};
+
+/* the metrics */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* count of verbs */
+	unsigned count;
+
+	/* the verbs */
+	struct verb *verbs;
+
+	/* the daemons */
+	struct daemon *buckets[METRICS_BUCKETS];
+}
+	metrics = { .mutex = X_MUTEX_INITIALIZER };
+
+uint64_t afs_metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* get the metrics of 'verb' (up to a slash), creating it if needed */
+static struct verb *get_verb(const char *verb)
+{
+	struct verb *v;
+	size_t len;
+
+	len = strcspn(verb, "/");
+	if (len >= METRICS_NAME_MAX)
+		len = METRICS_NAME_MAX - 1;
+	for (v = metrics.verbs ; v ; v = v->next)
+		if (!strncmp(v->name, verb, len) && !v->name[len])
+			return v;
+	if (metrics.count >= METRICS_VERBS_MAX)
+		return NULL;
+	v = calloc(1, sizeof *v);
+	if (v) {
+		memcpy(v->name, verb, len);
+		v->next = metrics.verbs;
+		metrics.verbs = v;
+		metrics.count++;
+	}
+	return v;
+}
+
+/* get the metrics of the daemon 'pid', creating it if 'create' is set */
+static struct daemon *get_daemon(int pid, int create)
+{
+	struct daemon *d, **pd;
+
+	pd = &metrics.buckets[(unsigned)pid & (METRICS_BUCKETS - 1)];
+	for (d = *pd ; d ; d = d->next)
+		if (d->pid == pid)
+			return d;
+	d = create ? calloc(1, sizeof *d) : NULL;
+	if (d) {
+		d->pid = pid;
+		d->next = *pd;
+		*pd = d;
+	}
+	return d;
+}
+
+void afs_metrics_request(const char *verb, uint64_t received_us, uint64_t authorized_us, uint64_t handled_us)
+{
+	struct verb *v;
+
+	x_mutex_lock(&metrics.mutex);
+	v = get_verb(verb);
+	if (v) {
+		v->count++;
+		afs_histo_add(&v->auth, authorized_us - received_us);
+		afs_histo_add(&v->handle, handled_us - authorized_us);
+	}
+	x_mutex_unlock(&metrics.mutex);
+}
+
+void afs_metrics_forward(int pid)
+{
+	struct daemon *d;
+
+	x_mutex_lock(&metrics.mutex);
+	d = get_daemon(pid, 1);
+	if (d) {
+		d->inflight++;
+		d->forwarded++;
+	}
+	x_mutex_unlock(&metrics.mutex);
+}
+
+void afs_metrics_reply(int pid, const char *verb, int status, uint64_t forwarded_us)
+{
+	struct daemon *d;
+	struct verb *v;
+	uint64_t duration;
+
+	duration = afs_metrics_now() - forwarded_us;
+	x_mutex_lock(&metrics.mutex);
+	d = get_daemon(pid, 0);
+	if (d) {
+		if (d->inflight)
+			d->inflight--;
+		d->errors += (uint64_t)(status < 0);
+		afs_histo_add(&d->roundtrip, duration);
+	}
+	v = get_verb(verb);
+	if (v)
+		afs_histo_add(&v->daemon, duration);
+	x_mutex_unlock(&metrics.mutex);
+}
+
+void afs_metrics_forget(int pid)
+{
+	struct daemon *d, **pd;
+
+	x_mutex_lock(&metrics.mutex);
+	pd = &metrics.buckets[(unsigned)pid & (METRICS_BUCKETS - 1)];
+	while ((d = *pd) && d->pid != pid)
+		pd = &d->next;
+	if (d) {
+		*pd = d->next;
+		free(d);
+	}
+	x_mutex_unlock(&metrics.mutex);
+}
+
+unsigned afs_metrics_inflight(void)
+{
+	struct daemon *d;
+	unsigned i, n;
+
+	n = 0;
+	x_mutex_lock(&metrics.mutex);
+	for (i = 0 ; i < METRICS_BUCKETS ; i++)
+		for (d = metrics.buckets[i] ; d ; d = d->next)
+			n += d->inflight;
+	x_mutex_unlock(&metrics.mutex);
+	return n;
+}
+
+struct json_object *afs_metrics_query(struct json_object *filter)
+{
+	struct json_object *result, *verbs, *daemons, *item, *pattern;
+	struct verb *v;
+	struct daemon *d;
+	unsigned i;
+	int pid;
+	char spid[20];
+
+	if (!json_object_is_type(filter, json_type_object))
+		filter = NULL;
+	if (!json_object_object_get_ex(filter, "verb", &pattern))
+		pattern = NULL;
+	pid = json_object_object_get_ex(filter, "pid", &item) ? json_object_get_int(item) : 0;
+
+	result = json_object_new_object();
+	verbs = json_object_new_object();
+	daemons = json_object_new_object();
+	x_mutex_lock(&metrics.mutex);
+	for (v = metrics.verbs ; v ; v = v->next) {
+		if (!pattern || !fnmatch(json_object_get_string(pattern) ?: "", v->name, 0)) {
+			item = json_object_new_object();
+			json_object_object_add(item, "count", json_object_new_int64((int64_t)v->count));
+			json_object_object_add(item, "auth", afs_histo_json(&v->auth));
+			json_object_object_add(item, "handle", afs_histo_json(&v->handle));
+			json_object_object_add(item, "daemon", afs_histo_json(&v->daemon));
+			json_object_object_add(verbs, v->name, item);
+		}
+	}
+	for (i = 0 ; i < METRICS_BUCKETS ; i++) {
+		for (d = metrics.buckets[i] ; d ; d = d->next) {
+			if (!pid || pid == d->pid) {
+				item = json_object_new_object();
+				json_object_object_add(item, "inflight", json_object_new_int64(d->inflight));
+				json_object_object_add(item, "forwarded", json_object_new_int64((int64_t)d->forwarded));
+				json_object_object_add(item, "errors", json_object_new_int64((int64_t)d->errors));
+				json_object_object_add(item, "roundtrip", afs_histo_json(&d->roundtrip));
+				snprintf(spid, sizeof spid, "%d", d->pid);
+				json_object_object_add(daemons, spid, item);
+			}
+		}
+	}
+	x_mutex_unlock(&metrics.mutex);
+	json_object_object_add(result, "verbs", verbs);
+	json_object_object_add(result, "daemons", daemons);
+	return result;
+}
+
+void afs_metrics_print(FILE *file)
+{
+	struct verb *v;
+	struct daemon *d;
+	unsigned i;
+	char labels[METRICS_NAME_MAX + 20];
+
+	x_mutex_lock(&metrics.mutex);
+	fprintf(file, "# TYPE afb_supervisor_request_auth_seconds summary\n");
+	for (v = metrics.verbs ; v ; v = v->next) {
+		snprintf(labels, sizeof labels, "verb=\"%s\"", v->name);
+		afs_histo_print(file, "afb_supervisor_request_auth_seconds", labels, &v->auth);
+	}
+	fprintf(file, "# TYPE afb_supervisor_request_handle_seconds summary\n");
+	for (v = metrics.verbs ; v ; v = v->next) {
+		snprintf(labels, sizeof labels, "verb=\"%s\"", v->name);
+		afs_histo_print(file, "afb_supervisor_request_handle_seconds", labels, &v->handle);
+	}
+	fprintf(file, "# TYPE afb_supervisor_forward_seconds summary\n");
+	for (v = metrics.verbs ; v ; v = v->next) {
+		snprintf(labels, sizeof labels, "verb=\"%s\"", v->name);
+		afs_histo_print(file, "afb_supervisor_forward_seconds", labels, &v->daemon);
+	}
+	fprintf(file, "# TYPE afb_supervisor_daemon_inflight gauge\n");
+	for (i = 0 ; i < METRICS_BUCKETS ; i++)
+		for (d = metrics.buckets[i] ; d ; d = d->next)
+			fprintf(file, "afb_supervisor_daemon_inflight{pid=\"%d\"} %u\n", d->pid, d->inflight);
+	fprintf(file, "# TYPE afb_supervisor_daemon_errors_total counter\n");
+	for (i = 0 ; i < METRICS_BUCKETS ; i++)
+		for (d = metrics.buckets[i] ; d ; d = d->next)
+			fprintf(file, "afb_supervisor_daemon_errors_total{pid=\"%d\"} %llu\n",
+				d->pid, (unsigned long long)d->errors);
+	fprintf(file, "# TYPE afb_supervisor_daemon_roundtrip_seconds summary\n");
+	for (i = 0 ; i < METRICS_BUCKETS ; i++) {
+		for (d = metrics.buckets[i] ; d ; d = d->next) {
+			snprintf(labels, sizeof labels, "pid=\"%d\"", d->pid);
+			afs_histo_print(file, "afb_supervisor_daemon_roundtrip_seconds", labels, &d->roundtrip);
+		}
+	}
+	x_mutex_unlock(&metrics.mutex);
+}
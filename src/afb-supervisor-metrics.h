@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct json_object;
+
+/**
+ * Returns the current monotonic time in microseconds
+ */
+extern uint64_t afs_metrics_now(void);
+
+/**
+ * Records for the verb 'verb' (up to an optional slash) a request
+ * received at 'received_us', authorized at 'authorized_us' and
+ * handled by the supervisor at 'handled_us'
+ */
+extern void afs_metrics_request(const char *verb, uint64_t received_us, uint64_t authorized_us, uint64_t handled_us);
+
+/**
+ * Records the forwarding of a request to the daemon 'pid'
+ */
+extern void afs_metrics_forward(int pid);
+
+/**
+ * Records the reply of 'status' of the daemon 'pid' to the request
+ * of verb 'verb' forwarded at 'forwarded_us'
+ */
+extern void afs_metrics_reply(int pid, const char *verb, int status, uint64_t forwarded_us);
+
+/**
+ * Forgets the metrics of the daemon 'pid'
+ */
+extern void afs_metrics_forget(int pid);
+
+/**
+ * Returns the count of requests currently forwarded to the daemons
+ */
+extern unsigned afs_metrics_inflight(void);
+
+/**
+ * Returns a new object with the metrics of the verbs and of the daemons
+ * matching 'filter' (keys: verb, glob pattern, and pid)
+ */
+extern struct json_object *afs_metrics_query(struct json_object *filter);
+
+/**
+ * Prints to 'file' the metrics of the verbs and of the daemons
+ * in the text exposition format of Prometheus
+ */
+extern void afs_metrics_print(FILE *file);
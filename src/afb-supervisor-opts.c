@@ -29,6 +29,7 @@
 #include <unistd.h>
 
 #include <libafb/misc/afb-verbose.h>
+#include <libafb/misc/afb-supervisor.h>
 #include "afb-supervisor-opts.h"
 
 #if !defined(AFB_SUPERVISOR_VERSION)
@@ -48,6 +49,15 @@
 					// 100000~=1day]
 #define CTX_NBCLIENTS       10		// allow a default of 10 authenticated
 					// clients
+#define DEFLT_DISCOVER_PERIOD_MAX 60000	// default maximal period of
+					// discovery in ms
+#define DEFLT_WAKEUP_BATCH  10		// default count of wake-up
+					// signals per batch
+#define DEFLT_WAKEUP_TIMEOUT 2000	// default timeout in ms for
+					// connecting after wake-up
+#define DEFLT_PROBE_STALL   5000	// default time in ms without reply
+					// making a probe stalled
+#define DEFLT_PROBE_VERB    "slist"	// default verb of probes
 
 
 // Define command line option
@@ -65,6 +75,25 @@
 
 #define SET_ROOT_HTTP      26
 
+#define SET_DISCOVER_WATCH 27
+#define SET_DISCOVER_PERIOD 28
+#define SET_DISCOVER_PERIOD_MAX 29
+#define SET_WAKEUP_RATE    30
+#define SET_WAKEUP_BATCH   31
+#define SET_WAKEUP_TIMEOUT 32
+#define SET_SUPERVISION_SOCKET 33
+#define SET_PROC_ROOT      34
+#define SET_TRACE_RING     35
+#define SET_CACHE_TTL      36
+#define SET_COALESCE       37
+#define SET_FEDERATION     38
+#define SET_UPSTREAM       39
+#define SET_NODE           40
+#define SET_SESSION_REFRESH 41
+#define SET_PROBE_PERIOD   42
+#define SET_PROBE_STALL    43
+#define SET_PROBE_VERB     44
+
 #define DISPLAY_HELP       'h'
 #define SET_NAME           'n'
 #define SET_TCP_PORT       'p'
@@ -110,11 +139,30 @@ static AFB_options cliOptions[] = {
 	{SET_SESSION_DIR,   1, "sessiondir",  "OBSOLETE (was: Sessions file path)"},
 
 	{WS_SERVICE,        1, "ws-server",   "Provide supervisor as websocket"},
+	{SET_SUPERVISION_SOCKET, 1, "supervision-socket", "Socket where daemons connect [default unix:" AFB_SUPERVISOR_SOCKET "]"},
+	{SET_FEDERATION,    1, "federation",  "Socket where child supervisors register [default none]"},
+	{SET_UPSTREAM,      1, "upstream",    "Socket of the parent supervisor to register with [default none]"},
+	{SET_NODE,          1, "node",        "Name of the node given to the parent supervisor [default: host name]"},
 	{DISPLAY_VERSION,   0, "version",     "Display version and copyright"},
 	{DISPLAY_HELP,      0, "help",        "Display this help"},
 
 	{SET_SESSIONMAX,    1, "session-max", "Max count of session simultaneously [default 10]"},
 
+	{SET_PROC_ROOT,     1, "proc-root",   "Directory of the proc filesystem scanned by discovery [default /proc]"},
+	{SET_DISCOVER_WATCH, 0, "discover-watch", "Watch daemons starting using the proc connector (needs CAP_NET_ADMIN)"},
+	{SET_DISCOVER_PERIOD, 1, "discover-period", "Minimal period in ms of automatic discovery [default 0: no automatic discovery]"},
+	{SET_DISCOVER_PERIOD_MAX, 1, "discover-period-max", "Maximal period in ms of automatic discovery [default 60000]"},
+	{SET_WAKEUP_RATE,   1, "wakeup-rate", "Count of wake-up signals per second [default 0: no pacing]"},
+	{SET_WAKEUP_BATCH,  1, "wakeup-batch", "Count of wake-up signals sent together [default 10]"},
+	{SET_WAKEUP_TIMEOUT, 1, "wakeup-timeout", "Time in ms to connect after wake-up before retrying [default 2000]"},
+	{SET_TRACE_RING,    1, "trace-ring",  "Count of trace events recorded for trace-query, shared by all daemons [default 0: none]"},
+	{SET_COALESCE,      1, "coalesce",    "Window in ms merging the add/del events of daemons [default 0: no coalescing]"},
+	{SET_CACHE_TTL,     1, "cache-ttl",   "Time in ms to live of the cached config and apis of daemons [default 0: no cache]"},
+	{SET_SESSION_REFRESH, 1, "session-refresh", "Age in ms of the indexed sessions of a daemon before refreshing them [default 0: no refresh]"},
+	{SET_PROBE_PERIOD,  1, "probe-period", "Period in ms of the probes of each daemon [default 0: no probing]"},
+	{SET_PROBE_STALL,   1, "probe-stall", "Time in ms without reply to a probe making the daemon stalled [default 5000]"},
+	{SET_PROBE_VERB,    1, "probe-verb",  "Verb of the supervision api called by probes [default " DEFLT_PROBE_VERB "]"},
+
 	{0, 0, NULL, NULL}
 /* *INDENT-ON* */
 };
@@ -321,6 +369,79 @@ static void parse_arguments(int argc, char **argv, struct optargs *config)
 			config->ws_server = argvalstr(optc);
 			break;
 
+		case SET_SUPERVISION_SOCKET:
+			config->supervision_socket = argvalstr(optc);
+			break;
+
+		case SET_FEDERATION:
+			config->federation = argvalstr(optc);
+			break;
+
+		case SET_UPSTREAM:
+			config->upstream = argvalstr(optc);
+			break;
+
+		case SET_NODE:
+			config->node = argvalstr(optc);
+			break;
+
+		case SET_PROC_ROOT:
+			config->proc_root = argvalstr(optc);
+			break;
+
+		case SET_DISCOVER_WATCH:
+			noarg(optc);
+			config->discover_watch = 1;
+			break;
+
+		case SET_DISCOVER_PERIOD:
+			config->discover_period = argvalintdec(optc, 0, INT_MAX);
+			break;
+
+		case SET_DISCOVER_PERIOD_MAX:
+			config->discover_period_max = argvalintdec(optc, 1, INT_MAX);
+			break;
+
+		case SET_WAKEUP_RATE:
+			config->wakeup_rate = argvalintdec(optc, 0, 1000000);
+			break;
+
+		case SET_WAKEUP_BATCH:
+			config->wakeup_batch = argvalintdec(optc, 1, INT_MAX);
+			break;
+
+		case SET_WAKEUP_TIMEOUT:
+			config->wakeup_timeout = argvalintdec(optc, 1, INT_MAX);
+			break;
+
+		case SET_TRACE_RING:
+			config->trace_ring = argvalintdec(optc, 0, 1000000);
+			break;
+
+		case SET_COALESCE:
+			config->coalesce = argvalintdec(optc, 0, 60000);
+			break;
+
+		case SET_CACHE_TTL:
+			config->cache_ttl = argvalintdec(optc, 0, INT_MAX);
+			break;
+
+		case SET_SESSION_REFRESH:
+			config->session_refresh = argvalintdec(optc, 0, INT_MAX);
+			break;
+
+		case SET_PROBE_PERIOD:
+			config->probe_period = argvalintdec(optc, 0, INT_MAX);
+			break;
+
+		case SET_PROBE_STALL:
+			config->probe_stall = argvalintdec(optc, 1, INT_MAX);
+			break;
+
+		case SET_PROBE_VERB:
+			config->probe_verb = argvalstr(optc);
+			break;
+
 		case DISPLAY_VERSION:
 			noarg(optc);
 			printVersion(stdout);
@@ -359,6 +480,22 @@ static void fulfill_config(struct optargs *config)
 	if (config->nbSessionMax == 0)
 		config->nbSessionMax = CTX_NBCLIENTS;
 
+	// maximal period of automatic discovery
+	if (config->discover_period_max == 0)
+		config->discover_period_max = DEFLT_DISCOVER_PERIOD_MAX;
+
+	// pacing of wake-ups
+	if (config->wakeup_batch == 0)
+		config->wakeup_batch = DEFLT_WAKEUP_BATCH;
+	if (config->wakeup_timeout == 0)
+		config->wakeup_timeout = DEFLT_WAKEUP_TIMEOUT;
+
+	// probing of daemons
+	if (config->probe_stall == 0)
+		config->probe_stall = DEFLT_PROBE_STALL;
+	if (config->probe_verb == NULL)
+		config->probe_verb = DEFLT_PROBE_VERB;
+
 	/* set directories */
 	if (config->workdir == NULL)
 		config->workdir = ".";
@@ -395,12 +532,30 @@ static void dump(struct optargs *config)
 	S(uploaddir)
 	S(name)
 	S(ws_server)
+	S(supervision_socket)
+	S(federation)
+	S(upstream)
+	S(node)
+	S(probe_verb)
+	S(proc_root)
 
 	D(httpdPort)
 	D(cacheTimeout)
 	D(apiTimeout)
 	D(cntxTimeout)
 	D(nbSessionMax)
+	D(discover_watch)
+	D(discover_period)
+	D(discover_period_max)
+	D(wakeup_rate)
+	D(wakeup_batch)
+	D(wakeup_timeout)
+	D(trace_ring)
+	D(cache_ttl)
+	D(session_refresh)
+	D(probe_period)
+	D(probe_stall)
+	D(coalesce)
 	P("---END-OF-CONFIG---\n");
 
 #undef V
@@ -32,6 +32,12 @@ struct optargs {
 	char *uploaddir;	// where to store transient files
 	char *name;		/* name to set to the daemon */
 	char *ws_server;	/* exported api */
+	char *supervision_socket; /* socket of supervision */
+	char *federation;	/* socket of registration of child supervisors */
+	char *upstream;		/* socket of the parent supervisor */
+	char *node;		/* name of the node for the parent supervisor */
+	char *probe_verb;	/* verb of the probes of daemons */
+	char *proc_root;	/* root of the scanned proc filesystem */
 
 	/* integers */
 	int httpdPort;
@@ -39,6 +45,18 @@ struct optargs {
 	int apiTimeout;
 	int cntxTimeout;	// Client Session Context timeout
 	int nbSessionMax;	// max count of sessions
+	int discover_watch;	/* watch starting daemons */
+	int discover_period;	/* minimal period of discovery in ms, 0 for none */
+	int discover_period_max; /* maximal period of discovery in ms */
+	int wakeup_rate;	/* count of wake-up signals per second, 0 for no pacing */
+	int wakeup_batch;	/* count of wake-up signals per batch */
+	int wakeup_timeout;	/* timeout of connection after wake-up in ms */
+	int trace_ring;		/* count of trace events recorded, 0 for none */
+	int cache_ttl;		/* time to live in ms of cached replies, 0 for none */
+	int session_refresh;	/* age in ms of indexed sessions before refresh, 0 for none */
+	int probe_period;	/* period in ms of the probes of daemons, 0 for none */
+	int probe_stall;	/* time in ms without reply making a probe stalled */
+	int coalesce;		/* coalescing window of add/del events in ms, 0 for none */
 };
 
 extern struct optargs *optargs_parse(int argc, char **argv);
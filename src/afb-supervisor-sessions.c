@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include <libafb/sys/x-mutex.h>
+
+#include "afb-supervisor-sessions.h"
+
+/* count of buckets of sessions (must be a power of 2) */
+#define SESSIONS_BUCKETS 1024
+
+/* count of buckets of daemons (must be a power of 2) */
+#define DAEMONS_BUCKETS 256
+
+/* a session and the daemons having it */
+struct session
+{
+	/* next of the bucket */
+	struct session *next;
+
+	/* count of pids and allocated size */
+	unsigned count;
+	unsigned size;
+
+	/* the pids of the daemons */
+	int *pids;
+
+	/* the uuid */
+	char uuid[];
+};
+
+/* a daemon and its sessions */
+struct daemon
+{
+	/* next of the bucket */
+	struct daemon *next;
+
+	/* pid of the daemon */
+	int pid;
+
+	/* time in us of the start of the pending refresh, 0 if none */
+	uint64_t pending_us;
+
+	/* time of the last refresh in us, 0 if never */
+	uint64_t refreshed_us;
+
+	/* count of sessions */
+	unsigned count;
+
+	/* the sessions */
+	struct session **sessions;
+};
+
+/* the index */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* count of sessions */
+	unsigned count;
+
+	/* count of refreshes */
+	uint64_t refreshes;
+
+	/* count of failed refreshes */
+	uint64_t failures;
+
+	/* the sessions */
+	struct session *sessions[SESSIONS_BUCKETS];
+
+	/* the daemons */
+	struct daemon *daemons[DAEMONS_BUCKETS];
+}
+	sindex = { .mutex = X_MUTEX_INITIALIZER };
+
+/* hash of a string */
+static unsigned hash_string(const char *str)
+{
+	unsigned hash = 0;
+
+	while (*str)
+		hash = hash * 31 + (unsigned char)*str++;
+	return hash;
+}
+
+/* get the daemon 'pid', creating it if 'create' is set */
+static struct daemon *get_daemon(int pid, int create)
+{
+	struct daemon *d, **pd;
+
+	pd = &sindex.daemons[(unsigned)pid & (DAEMONS_BUCKETS - 1)];
+	for (d = *pd ; d ; d = d->next)
+		if (d->pid == pid)
+			return d;
+	d = create ? calloc(1, sizeof *d) : NULL;
+	if (d) {
+		d->pid = pid;
+		d->next = *pd;
+		*pd = d;
+	}
+	return d;
+}
+
+/* get the session 'uuid', creating it if 'create' is set */
+static struct session *get_session(const char *uuid, int create)
+{
+	struct session *s, **ps;
+	size_t len;
+
+	ps = &sindex.sessions[hash_string(uuid) & (SESSIONS_BUCKETS - 1)];
+	for (s = *ps ; s ; s = s->next)
+		if (!strcmp(s->uuid, uuid))
+			return s;
+	len = strlen(uuid);
+	s = create ? calloc(1, sizeof *s + len + 1) : NULL;
+	if (s) {
+		memcpy(s->uuid, uuid, len + 1);
+		s->next = *ps;
+		*ps = s;
+		sindex.count++;
+	}
+	return s;
+}
+
+/* unlink and free the session 's' */
+static void free_session(struct session *s)
+{
+	struct session **ps;
+
+	ps = &sindex.sessions[hash_string(s->uuid) & (SESSIONS_BUCKETS - 1)];
+	while (*ps != s)
+		ps = &(*ps)->next;
+	*ps = s->next;
+	sindex.count--;
+	free(s->pids);
+	free(s);
+}
+
+/* remove 'pid' from the session 's', freeing it if it becomes empty */
+static void session_remove(struct session *s, int pid)
+{
+	unsigned i;
+
+	for (i = 0 ; i < s->count ; i++)
+		if (s->pids[i] == pid) {
+			s->pids[i] = s->pids[--s->count];
+			break;
+		}
+	if (!s->count)
+		free_session(s);
+}
+
+/* add 'pid' to the session 's' */
+static int session_add(struct session *s, int pid)
+{
+	int *pids;
+
+	if (s->count == s->size) {
+		pids = realloc(s->pids, (s->size + 4) * sizeof *pids);
+		if (!pids)
+			return -1;
+		s->pids = pids;
+		s->size += 4;
+	}
+	s->pids[s->count++] = pid;
+	return 0;
+}
+
+/* remove the daemon 'd' from its sessions */
+static void daemon_clear(struct daemon *d)
+{
+	while (d->count)
+		session_remove(d->sessions[--d->count], d->pid);
+	free(d->sessions);
+	d->sessions = NULL;
+}
+
+void afs_sessions_track(int pid)
+{
+	struct daemon *d;
+
+	x_mutex_lock(&sindex.mutex);
+	d = get_daemon(pid, 1);
+	if (d)
+		d->refreshed_us = d->pending_us = 0;
+	x_mutex_unlock(&sindex.mutex);
+}
+
+void afs_sessions_forget(int pid)
+{
+	struct daemon *d, **pd;
+
+	x_mutex_lock(&sindex.mutex);
+	pd = &sindex.daemons[(unsigned)pid & (DAEMONS_BUCKETS - 1)];
+	while ((d = *pd) && d->pid != pid)
+		pd = &d->next;
+	if (d) {
+		*pd = d->next;
+		daemon_clear(d);
+		free(d);
+	}
+	x_mutex_unlock(&sindex.mutex);
+}
+
+void afs_sessions_set(int pid, struct json_object *sessions, uint64_t now_us)
+{
+	struct daemon *d;
+	struct session *s;
+	size_t n;
+
+	x_mutex_lock(&sindex.mutex);
+	d = get_daemon(pid, 0);
+	if (d) {
+		d->pending_us = 0;
+		d->refreshed_us = now_us;
+		sindex.refreshes++;
+		if (!json_object_is_type(sessions, json_type_object))
+			sindex.failures++;
+		else {
+			daemon_clear(d);
+			n = (size_t)json_object_object_length(sessions);
+			d->sessions = n ? malloc(n * sizeof *d->sessions) : NULL;
+			if (d->sessions) {
+				json_object_object_foreach(sessions, uuid, value) {
+					(void)value;
+					s = get_session(uuid, 1);
+					if (s && d->count < n && session_add(s, pid) == 0)
+						d->sessions[d->count++] = s;
+					else if (s && !s->count)
+						free_session(s);
+				}
+			}
+		}
+	}
+	x_mutex_unlock(&sindex.mutex);
+}
+
+unsigned afs_sessions_due(uint64_t now_us, uint64_t age_us, int pids[], unsigned max)
+{
+	struct daemon *d, **due;
+	unsigned i, j, n;
+	uint64_t before_us;
+
+	due = malloc(max * sizeof *due);
+	if (!due)
+		return 0;
+
+	/*
+	 * select the oldest, sorted by insertion, a pending refresh
+	 * without reply for 'age_us' being given up
+	 */
+	before_us = now_us > age_us ? now_us - age_us : 0;
+	n = 0;
+	x_mutex_lock(&sindex.mutex);
+	for (i = 0 ; i < DAEMONS_BUCKETS ; i++)
+		for (d = sindex.daemons[i] ; d ; d = d->next) {
+			if (d->pending_us > before_us || d->refreshed_us >= before_us)
+				continue;
+			if (n == max) {
+				if (d->refreshed_us >= due[n - 1]->refreshed_us)
+					continue;
+				n--;
+			}
+			for (j = n++ ; j && due[j - 1]->refreshed_us > d->refreshed_us ; j--)
+				due[j] = due[j - 1];
+			due[j] = d;
+		}
+	for (i = 0 ; i < n ; i++) {
+		due[i]->pending_us = now_us;
+		pids[i] = due[i]->pid;
+	}
+	x_mutex_unlock(&sindex.mutex);
+	free(due);
+	return n;
+}
+
+struct json_object *afs_sessions_lookup(const char *uuid)
+{
+	struct json_object *array;
+	struct session *s;
+	unsigned i;
+
+	array = json_object_new_array();
+	x_mutex_lock(&sindex.mutex);
+	s = get_session(uuid, 0);
+	for (i = 0 ; s && i < s->count ; i++)
+		json_object_array_add(array, json_object_new_int(s->pids[i]));
+	x_mutex_unlock(&sindex.mutex);
+	return array;
+}
+
+void afs_sessions_drop(const char *uuid)
+{
+	struct session *s;
+	struct daemon *d;
+	unsigned i, j;
+
+	x_mutex_lock(&sindex.mutex);
+	s = get_session(uuid, 0);
+	if (s) {
+		for (i = 0 ; i < s->count ; i++) {
+			d = get_daemon(s->pids[i], 0);
+			for (j = 0 ; d && j < d->count ; j++)
+				if (d->sessions[j] == s) {
+					d->sessions[j] = d->sessions[--d->count];
+					break;
+				}
+		}
+		free_session(s);
+	}
+	x_mutex_unlock(&sindex.mutex);
+}
+
+void afs_sessions_counters(struct json_object *resu)
+{
+	struct json_object *item;
+	struct daemon *d;
+	unsigned i, daemons;
+
+	item = json_object_new_object();
+	x_mutex_lock(&sindex.mutex);
+	daemons = 0;
+	for (i = 0 ; i < DAEMONS_BUCKETS ; i++)
+		for (d = sindex.daemons[i] ; d ; d = d->next)
+			daemons++;
+	json_object_object_add(item, "sessions", json_object_new_int64(sindex.count));
+	json_object_object_add(item, "daemons", json_object_new_int64(daemons));
+	json_object_object_add(item, "refreshes", json_object_new_int64((int64_t)sindex.refreshes));
+	json_object_object_add(item, "failures", json_object_new_int64((int64_t)sindex.failures));
+	x_mutex_unlock(&sindex.mutex);
+	json_object_object_add(resu, "sessions", item);
+}
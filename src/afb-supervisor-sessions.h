@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct json_object;
+
+/**
+ * Starts indexing the sessions of the daemon 'pid', due at once
+ */
+extern void afs_sessions_track(int pid);
+
+/**
+ * Forgets the daemon 'pid' and its sessions
+ */
+extern void afs_sessions_forget(int pid);
+
+/**
+ * Sets at 'now_us' the sessions of the daemon 'pid' to the keys of
+ * 'sessions' (as replied by slist). When 'sessions' is NULL, the
+ * refresh failed and the known sessions are kept.
+ */
+extern void afs_sessions_set(int pid, struct json_object *sessions, uint64_t now_us);
+
+/**
+ * Gives in 'pids' at most 'max' daemons not refreshed for 'age_us' at
+ * 'now_us' nor being refreshed since less than 'age_us', oldest first,
+ * and marks them as being refreshed. Returns the count of pids given.
+ */
+extern unsigned afs_sessions_due(uint64_t now_us, uint64_t age_us, int pids[], unsigned max);
+
+/**
+ * Returns a new array of the pids of the daemons having the session 'uuid'
+ */
+extern struct json_object *afs_sessions_lookup(const char *uuid);
+
+/**
+ * Removes the session 'uuid' from the index
+ */
+extern void afs_sessions_drop(const char *uuid);
+
+/**
+ * Adds to 'resu' the counters of the index of sessions
+ */
+extern void afs_sessions_counters(struct json_object *resu);
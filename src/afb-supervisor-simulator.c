@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+/*
+ * Simulator of supervised daemons for benchmarking the supervisor.
+ *
+ * It forks COUNT processes, each connecting to the supervision socket
+ * like a daemon, accepting the initiator of the supervisor and serving
+ * the supervision api: config replies the configuration given (or a
+ * default one), slist replies SESSIONS sessions, do replies an object
+ * echoing its api and verb and the other verbs reply success without
+ * effect. The replies are delayed by LATENCY milliseconds.
+ *
+ * usage: afb-supervisor-simulator [-n COUNT] [-s URI] [-l LATENCY]
+ *                                 [-S SESSIONS] [-c CONFIG-FILE]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#include <json-c/json.h>
+
+#include <libafb/core/afb-apiset.h>
+#include <libafb/core/afb-req-common.h>
+#include <libafb/core/afb-session.h>
+#include <libafb/core/afb-json-legacy.h>
+#include <libafb/core/afb-sched.h>
+#include <libafb/sys/ev-mgr.h>
+#include <libafb/core/afb-ev-mgr.h>
+#include <libafb/wsapi/afb-stub-ws.h>
+#include <libafb/misc/afb-socket.h>
+#include <libafb/misc/afb-supervisor.h>
+#include <libafb/misc/afb-verbose.h>
+
+/* default count of simulated daemons */
+#define DEFLT_COUNT 100
+
+/* default count of sessions of each daemon */
+#define DEFLT_SESSIONS 4
+
+/* count of sessions of the clients served */
+#define CLIENT_SESSIONS 100
+
+/* the simulation */
+static struct {
+	/* uri of the supervision socket */
+	const char *socket;
+
+	/* count of daemons */
+	unsigned count;
+
+	/* latency of the replies in ms */
+	unsigned latency_ms;
+
+	/* count of sessions */
+	unsigned sessions;
+
+	/* reply of config */
+	struct json_object *config;
+}
+	sim = {
+		.socket = "unix:" AFB_SUPERVISOR_SOCKET,
+		.count = DEFLT_COUNT,
+		.sessions = DEFLT_SESSIONS
+	};
+
+/* a reply delayed by the latency */
+struct delayed
+{
+	/* the request */
+	struct afb_req_common *req;
+
+	/* its reply */
+	struct json_object *reply;
+};
+
+static void delayed_cb(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	struct delayed *delayed = closure;
+
+	afb_json_legacy_req_reply_hookable(delayed->req, delayed->reply, NULL, NULL);
+	afb_req_common_unref(delayed->req);
+	free(delayed);
+}
+
+/* reply 'obj' to 'req' after the latency */
+static void reply(struct afb_req_common *req, struct json_object *obj)
+{
+	struct ev_timer *timer;
+	struct delayed *delayed;
+
+	delayed = sim.latency_ms ? malloc(sizeof *delayed) : NULL;
+	if (!delayed) {
+		afb_json_legacy_req_reply_hookable(req, obj, NULL, NULL);
+		return;
+	}
+	delayed->req = afb_req_common_addref(req);
+	delayed->reply = obj;
+	if (afb_ev_mgr_add_timer(&timer, 0,
+			(time_t)(sim.latency_ms / 1000), sim.latency_ms % 1000,
+			1, 0, 1, delayed_cb, delayed, 1) < 0)
+		delayed_cb(NULL, delayed, 0);
+}
+
+/* make the reply of slist */
+static struct json_object *make_sessions()
+{
+	struct json_object *obj;
+	char uuid[64];
+	unsigned i;
+
+	obj = json_object_new_object();
+	for (i = 0 ; i < sim.sessions ; i++) {
+		snprintf(uuid, sizeof uuid, "sim-%d-%u", (int)getpid(), i);
+		json_object_object_add(obj, uuid, json_object_new_object());
+	}
+	return obj;
+}
+
+/* make the reply of do */
+static struct json_object *make_do(struct afb_req_common *req)
+{
+	struct json_object *args, *obj, *item;
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "pid", json_object_new_int((int)getpid()));
+	if (afb_json_legacy_get_single_json_c(req->params.ndata, req->params.data, &args) >= 0) {
+		if (json_object_object_get_ex(args, "api", &item))
+			json_object_object_add(obj, "api", json_object_get(item));
+		if (json_object_object_get_ex(args, "verb", &item))
+			json_object_object_add(obj, "verb", json_object_get(item));
+	}
+	return obj;
+}
+
+static void sim_process(void *closure, struct afb_req_common *req)
+{
+	const char *verb = req->verbname;
+
+	if (!strcmp(verb, "config"))
+		reply(req, json_object_get(sim.config));
+	else if (!strcmp(verb, "slist"))
+		reply(req, make_sessions());
+	else if (!strcmp(verb, "do"))
+		reply(req, make_do(req));
+	else if (!strcmp(verb, "trace")
+	      || !strcmp(verb, "sclose")
+	      || !strcmp(verb, "exit")
+	      || !strcmp(verb, "wait")
+	      || !strcmp(verb, "break"))
+		reply(req, NULL);
+	else
+		afb_req_common_reply_verb_unknown_error_hookable(req);
+}
+
+static void sim_describe(void *closure, void (*describecb)(void *, struct json_object *), void *clocb)
+{
+	describecb(clocb, NULL);
+}
+
+static struct afb_api_itf sim_itf =
+{
+	.process = sim_process,
+	.describe = sim_describe
+};
+
+static void on_hangup(struct afb_stub_ws *stub)
+{
+	exit(0);
+}
+
+/* start a simulated daemon */
+static void start(int signum, void *arg)
+{
+	struct afb_supervisor_initiator asi;
+	struct afb_apiset *apiset;
+	struct afb_api_item item;
+	struct afb_stub_ws *stub;
+	int fd;
+
+	if (signum)
+		exit(1);
+
+	/* create the supervision api */
+	apiset = afb_apiset_create(AFB_SUPERVISION_APINAME, 0);
+	item.closure = NULL;
+	item.group = NULL;
+	item.itf = &sim_itf;
+	if (!apiset
+	 || afb_apiset_add(apiset, AFB_SUPERVISION_APINAME, item) < 0
+	 || afb_session_init(CLIENT_SESSIONS, 3600)) {
+		LIBAFB_ERROR("can't create the supervision api");
+		exit(1);
+	}
+
+	/* connect and get the initiator */
+	fd = afb_socket_open(sim.socket, 0);
+	if (fd < 0) {
+		LIBAFB_ERROR("can't connect to %s", sim.socket);
+		exit(1);
+	}
+	if (read(fd, &asi, sizeof asi) != (ssize_t)sizeof asi
+	 || strncmp(asi.interface, AFB_SUPERVISOR_INTERFACE_1, sizeof asi.interface)) {
+		LIBAFB_ERROR("bad initiator from %s", sim.socket);
+		exit(1);
+	}
+
+	/* serve the supervisor */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	stub = afb_stub_ws_create_server(fd, 1, AFB_SUPERVISION_APINAME, apiset);
+	if (!stub) {
+		LIBAFB_ERROR("can't serve the supervisor");
+		exit(1);
+	}
+	afb_stub_ws_set_on_hangup(stub, on_hangup);
+}
+
+int main(int ac, char **av)
+{
+	unsigned i, started;
+	int opt;
+	pid_t pid;
+
+	while ((opt = getopt(ac, av, "n:s:l:S:c:")) != -1) {
+		switch (opt) {
+		case 'n':
+			sim.count = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			sim.socket = optarg;
+			break;
+		case 'l':
+			sim.latency_ms = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			sim.sessions = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			sim.config = json_object_from_file(optarg);
+			if (!sim.config) {
+				fprintf(stderr, "can't read the config %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n COUNT] [-s URI] [-l LATENCY-MS] [-S SESSIONS] [-c CONFIG-FILE]\n", av[0]);
+			return 1;
+		}
+	}
+	if (!sim.config) {
+		sim.config = json_object_new_object();
+		json_object_object_add(sim.config, "simulated", json_object_new_boolean(1));
+	}
+
+	/* fork the daemons */
+	for (started = i = 0 ; i < sim.count ; i++) {
+		pid = fork();
+		if (pid == 0) {
+			afb_sched_start(1, 0, 16, start, NULL);
+			_exit(1);
+		}
+		if (pid < 0)
+			fprintf(stderr, "can't fork daemon %u: %s\n", i, strerror(errno));
+		else
+			started++;
+	}
+	fprintf(stderr, "%u simulated daemons started\n", started);
+
+	/* wait them */
+	while (started)
+		if (wait(NULL) > 0)
+			started--;
+		else if (errno != EINTR)
+			break;
+	return 0;
+}
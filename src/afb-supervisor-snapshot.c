@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libafb/misc/afb-verbose.h>
+#include <libafb/sys/x-mutex.h>
+
+#include "afb-discover.h"
+#include "afb-supervisor-snapshot.h"
+
+/* magic number of snapshot files: "AFSS" */
+#define SNAPSHOT_MAGIC 0x53534641U
+
+/* version of the format of snapshot files */
+#define SNAPSHOT_VERSION 1
+
+/* count of entries of snapshot files, a power of 2 */
+#define SNAPSHOT_CAPACITY 4096
+
+/*
+ * an entry of the snapshot, free when pid is zero
+ * the entries are an open addressing table of the pids, linearly probed
+ */
+struct entry
+{
+	/* pid of the daemon */
+	int32_t pid;
+
+	/* user and group of the daemon */
+	uint32_t uid;
+	uint32_t gid;
+
+	/* reserved */
+	uint32_t reserved;
+
+	/* start time of the daemon in clock ticks since boot */
+	uint64_t start;
+};
+
+/* layout of snapshot files */
+struct layout
+{
+	/* SNAPSHOT_MAGIC */
+	uint32_t magic;
+
+	/* SNAPSHOT_VERSION */
+	uint32_t version;
+
+	/* SNAPSHOT_CAPACITY */
+	uint32_t capacity;
+
+	/* reserved */
+	uint32_t reserved;
+
+	/* the entries */
+	struct entry entries[SNAPSHOT_CAPACITY];
+};
+
+/* the mapped snapshot */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* the mapping or NULL */
+	struct layout *layout;
+
+	/* was the overflow of the snapshot reported? */
+	int overflowed;
+}
+	snapshot = { .mutex = X_MUTEX_INITIALIZER };
+
+int afs_snapshot_open(const char *path, void (*callback)(void *closure, pid_t pid), void *closure)
+{
+	int fd, n;
+	unsigned i;
+	struct stat st;
+	struct entry *entry;
+	struct layout *layout;
+	uint64_t start;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0
+	 || (st.st_size != (off_t)sizeof *layout && ftruncate(fd, (off_t)sizeof *layout) < 0)) {
+		n = -errno;
+		close(fd);
+		return n;
+	}
+	layout = mmap(NULL, sizeof *layout, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (layout == MAP_FAILED)
+		return -errno;
+
+	/* give the previous daemons still running */
+	n = 0;
+	if (layout->magic == SNAPSHOT_MAGIC
+	 && layout->version == SNAPSHOT_VERSION
+	 && layout->capacity == SNAPSHOT_CAPACITY) {
+		for (i = 0 ; i < SNAPSHOT_CAPACITY ; i++) {
+			entry = &layout->entries[i];
+			if (entry->pid > 0
+			 && afs_discover_start_time((pid_t)entry->pid, &start) == 0
+			 && start == entry->start) {
+				callback(closure, (pid_t)entry->pid);
+				n++;
+			}
+		}
+	}
+	else if (layout->magic)
+		LIBAFB_WARNING("ignoring the invalid snapshot %s", path);
+
+	/* restart from an empty snapshot */
+	memset(layout, 0, sizeof *layout);
+	layout->magic = SNAPSHOT_MAGIC;
+	layout->version = SNAPSHOT_VERSION;
+	layout->capacity = SNAPSHOT_CAPACITY;
+
+	x_mutex_lock(&snapshot.mutex);
+	if (snapshot.layout)
+		munmap(snapshot.layout, sizeof *snapshot.layout);
+	snapshot.layout = layout;
+	snapshot.overflowed = 0;
+	x_mutex_unlock(&snapshot.mutex);
+	return n;
+}
+
+/* index of the first slot probed for 'pid' */
+static inline unsigned home(int32_t pid)
+{
+	return ((uint32_t)pid * 2654435761U) & (SNAPSHOT_CAPACITY - 1);
+}
+
+/*
+ * search the entry of 'pid' or else the free entry where to put it,
+ * return NULL when the snapshot is full, snapshot.mutex held
+ */
+static struct entry *search(int32_t pid)
+{
+	unsigned i, n;
+	struct entry *entry;
+
+	i = home(pid);
+	for (n = 0 ; n < SNAPSHOT_CAPACITY ; n++) {
+		entry = &snapshot.layout->entries[i];
+		if (entry->pid == pid || entry->pid == 0)
+			return entry;
+		i = (i + 1) & (SNAPSHOT_CAPACITY - 1);
+	}
+	return NULL;
+}
+
+/*
+ * free the 'entry', moving back the entries following it in its
+ * chain of probing, snapshot.mutex held
+ */
+static void release(struct entry *entry)
+{
+	unsigned i, j, k;
+	struct entry *entries = snapshot.layout->entries;
+
+	i = j = (unsigned)(entry - entries);
+	for (;;) {
+		j = (j + 1) & (SNAPSHOT_CAPACITY - 1);
+		if (entries[j].pid == 0)
+			break;
+		/* move back the entry j if its home isn't cyclically in ]i, j] */
+		k = home(entries[j].pid);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		entries[i] = entries[j];
+		i = j;
+	}
+	memset(&entries[i], 0, sizeof entries[i]);
+}
+
+void afs_snapshot_add(pid_t pid, uid_t uid, gid_t gid)
+{
+	struct entry *entry;
+	uint64_t start;
+
+	if (!snapshot.layout || afs_discover_start_time(pid, &start) < 0)
+		return;
+
+	x_mutex_lock(&snapshot.mutex);
+	entry = search((int32_t)pid);
+	if (entry) {
+		entry->uid = (uint32_t)uid;
+		entry->gid = (uint32_t)gid;
+		entry->start = start;
+		entry->pid = (int32_t)pid;
+	}
+	else if (!snapshot.overflowed) {
+		snapshot.overflowed = 1;
+		LIBAFB_WARNING("snapshot full, the daemons over %d will be found by discovery on restart",
+				SNAPSHOT_CAPACITY);
+	}
+	x_mutex_unlock(&snapshot.mutex);
+}
+
+void afs_snapshot_del(pid_t pid)
+{
+	struct entry *entry;
+
+	if (!snapshot.layout)
+		return;
+
+	x_mutex_lock(&snapshot.mutex);
+	entry = search((int32_t)pid);
+	if (entry && entry->pid) {
+		release(entry);
+		snapshot.overflowed = 0;
+	}
+	x_mutex_unlock(&snapshot.mutex);
+}
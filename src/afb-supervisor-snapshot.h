@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+/**
+ * Maps the snapshot file 'path' of the superviseds, creating it if needed.
+ * The daemons recorded by a previous instance and still running are
+ * given to 'callback' before being forgotten.
+ * Returns the count of daemons given to 'callback' or a negative error code.
+ */
+extern int afs_snapshot_open(const char *path, void (*callback)(void *closure, pid_t pid), void *closure);
+
+/**
+ * Records in the snapshot the supervised daemon 'pid' of 'uid' and 'gid'
+ */
+extern void afs_snapshot_add(pid_t pid, uid_t uid, gid_t gid);
+
+/**
+ * Removes from the snapshot the daemon 'pid'
+ */
+extern void afs_snapshot_del(pid_t pid);
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include <json-c/json.h>
+
+#include <libafb/sys/x-mutex.h>
+
+#include "afb-supervisor-histo.h"
+#include "afb-supervisor-stats.h"
+
+/* count of slots of pending requests (must be a power of 2) */
+#define STATS_PENDINGS 4096
+
+/* count of buckets of verbs (must be a power of 2) */
+#define STATS_BUCKETS 256
+
+/* maximal count of recorded verbs */
+#define STATS_VERBS_MAX 1024
+
+/* a request begun and not yet ended */
+struct pending
+{
+	/* time of the begin in us or 0 when the slot is free */
+	uint64_t begin_us;
+
+	/* pid of the daemon */
+	int pid;
+
+	/* index of the request */
+	int index;
+
+	/* did it fail? */
+	int failed;
+};
+
+/* statistics of a verb */
+struct verb
+{
+	/* next of the bucket */
+	struct verb *next;
+
+	/* name of the verb */
+	const char *verb;
+
+	/* count of ended requests */
+	uint64_t count;
+
+	/* count of failed requests */
+	uint64_t errors;
+
+	/* latencies in us */
+	struct afs_histo latency;
+
+	/* name of the api followed by the name of the verb */
+	char api[];
+};
+
+/* the statistics */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* count of verbs */
+	unsigned count;
+
+	/* count of ends without begin */
+	uint64_t unmatched;
+
+	/* count of begins overwritten before their end */
+	uint64_t evicted;
+
+	/* count of requests not recorded because too many verbs */
+	uint64_t overflow;
+
+	/* the verbs */
+	struct verb *buckets[STATS_BUCKETS];
+
+	/* the pending requests */
+	struct pending pendings[STATS_PENDINGS];
+}
+	stats = { .mutex = X_MUTEX_INITIALIZER };
+
+/* hash of a string */
+static unsigned hash_string(const char *str, unsigned hash)
+{
+	while (*str)
+		hash = hash * 31 + (unsigned char)*str++;
+	return hash;
+}
+
+/* get the slot of the request 'index' of 'pid' */
+static struct pending *slot(int pid, int index)
+{
+	unsigned hash = (unsigned)pid * 2654435761U + (unsigned)index;
+
+	return &stats.pendings[hash & (STATS_PENDINGS - 1)];
+}
+
+/* get the time of 'event' in us, "time" being a string of seconds with decimals */
+static uint64_t time_of(struct json_object *event)
+{
+	struct json_object *item;
+	const char *str;
+	uint64_t sec, usec;
+	unsigned digits;
+
+	str = json_object_object_get_ex(event, "time", &item) ? json_object_get_string(item) : NULL;
+	if (!str)
+		return 0;
+	for (sec = 0 ; *str >= '0' && *str <= '9' ; str++)
+		sec = sec * 10 + (uint64_t)(*str - '0');
+	usec = 0;
+	digits = 0;
+	if (*str == '.')
+		for (str++ ; *str >= '0' && *str <= '9' && digits < 6 ; str++, digits++)
+			usec = usec * 10 + (uint64_t)(*str - '0');
+	while (digits++ < 6)
+		usec *= 10;
+	return sec * 1000000 + usec + 1;
+}
+
+/* check if the reply of 'event' tells an error */
+static int is_error_reply(struct json_object *event)
+{
+	struct json_object *data, *item;
+
+	if (!json_object_object_get_ex(event, "data", &data))
+		return 0;
+	if (json_object_object_get_ex(data, "error", &item) && item)
+		return 1;
+	return json_object_object_get_ex(data, "status", &item)
+		&& json_object_is_type(item, json_type_int)
+		&& json_object_get_int(item) < 0;
+}
+
+/* get the statistics of 'api' and 'verb', creating it if needed */
+static struct verb *get_verb(const char *api, const char *verb)
+{
+	struct verb *v, **pv;
+	size_t la, lv;
+
+	pv = &stats.buckets[hash_string(verb, hash_string(api, 0)) & (STATS_BUCKETS - 1)];
+	for (v = *pv ; v ; v = v->next)
+		if (!strcmp(v->api, api) && !strcmp(v->verb, verb))
+			return v;
+	if (stats.count >= STATS_VERBS_MAX)
+		return NULL;
+	la = strlen(api) + 1;
+	lv = strlen(verb) + 1;
+	v = calloc(1, sizeof *v + la + lv);
+	if (v) {
+		memcpy(v->api, api, la);
+		v->verb = memcpy(&v->api[la], verb, lv);
+		v->next = *pv;
+		*pv = v;
+		stats.count++;
+	}
+	return v;
+}
+
+/* record the 'end' at 'end_us' of the 'request' begun as 'p' */
+static void record_end(struct pending *p, uint64_t end_us, struct json_object *request)
+{
+	struct json_object *api, *verb;
+	struct verb *v;
+
+	if (!json_object_object_get_ex(request, "api", &api)
+	 || !json_object_object_get_ex(request, "verb", &verb))
+		return;
+	v = get_verb(json_object_get_string(api) ?: "", json_object_get_string(verb) ?: "");
+	if (!v)
+		stats.overflow++;
+	else {
+		v->count++;
+		v->errors += (uint64_t)!!p->failed;
+		afs_histo_add(&v->latency, end_us > p->begin_us ? end_us - p->begin_us : 0);
+	}
+}
+
+void afs_stats_trace_event(int pid, struct json_object *event)
+{
+	struct json_object *item, *request;
+	struct pending *p;
+	const char *action;
+	uint64_t time_us;
+	int index;
+
+	/* extract the data of request events */
+	if (!json_object_object_get_ex(event, "type", &item)
+	 || strcmp(json_object_get_string(item) ?: "", "request")
+	 || !json_object_object_get_ex(event, "request", &request)
+	 || !json_object_object_get_ex(request, "action", &item)
+	 || !(action = json_object_get_string(item))
+	 || !json_object_object_get_ex(request, "index", &item))
+		return;
+	index = json_object_get_int(item);
+
+	x_mutex_lock(&stats.mutex);
+	p = slot(pid, index);
+	if (!strcmp(action, "begin")) {
+		time_us = time_of(event);
+		if (time_us) {
+			if (p->begin_us)
+				stats.evicted++;
+			p->begin_us = time_us;
+			p->pid = pid;
+			p->index = index;
+			p->failed = 0;
+		}
+	}
+	else if (!p->begin_us || p->pid != pid || p->index != index) {
+		if (!strcmp(action, "end"))
+			stats.unmatched++;
+	}
+	else if (!strcmp(action, "end")) {
+		record_end(p, time_of(event), request);
+		p->begin_us = 0;
+	}
+	else if (!strcmp(action, "fail")
+	      || (!strcmp(action, "reply") && is_error_reply(event)))
+		p->failed = 1;
+	x_mutex_unlock(&stats.mutex);
+}
+
+/* check if 'value' matches the glob pattern 'key' of 'filter' */
+static int match(struct json_object *filter, const char *key, const char *value)
+{
+	struct json_object *item;
+
+	return !json_object_object_get_ex(filter, key, &item)
+		|| !fnmatch(json_object_get_string(item) ?: "", value, 0);
+}
+
+struct json_object *afs_stats_query(struct json_object *filter)
+{
+	struct json_object *result, *verbs, *item;
+	struct verb *v, *next;
+	unsigned i;
+	int reset;
+
+	if (!json_object_is_type(filter, json_type_object))
+		filter = NULL;
+	reset = json_object_object_get_ex(filter, "reset", &item) && json_object_get_boolean(item);
+
+	result = json_object_new_object();
+	verbs = json_object_new_array();
+	x_mutex_lock(&stats.mutex);
+	for (i = 0 ; i < STATS_BUCKETS ; i++) {
+		for (v = stats.buckets[i] ; v ; v = v->next) {
+			if (match(filter, "api", v->api) && match(filter, "verb", v->verb)) {
+				item = json_object_new_object();
+				json_object_object_add(item, "api", json_object_new_string(v->api));
+				json_object_object_add(item, "verb", json_object_new_string(v->verb));
+				json_object_object_add(item, "count", json_object_new_int64((int64_t)v->count));
+				json_object_object_add(item, "errors", json_object_new_int64((int64_t)v->errors));
+				json_object_object_add(item, "latency", afs_histo_json(&v->latency));
+				json_object_array_add(verbs, item);
+			}
+		}
+	}
+	json_object_object_add(result, "verbs", verbs);
+	json_object_object_add(result, "unmatched", json_object_new_int64((int64_t)stats.unmatched));
+	json_object_object_add(result, "evicted", json_object_new_int64((int64_t)stats.evicted));
+	json_object_object_add(result, "overflow", json_object_new_int64((int64_t)stats.overflow));
+	if (reset) {
+		for (i = 0 ; i < STATS_BUCKETS ; i++) {
+			for (v = stats.buckets[i] ; v ; v = next) {
+				next = v->next;
+				free(v);
+			}
+			stats.buckets[i] = NULL;
+		}
+		stats.count = 0;
+		stats.unmatched = stats.evicted = stats.overflow = 0;
+	}
+	x_mutex_unlock(&stats.mutex);
+	return result;
+}
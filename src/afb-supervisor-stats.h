@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+struct json_object;
+
+/**
+ * Correlates the trace 'event' received from the daemon 'pid'
+ * with the previous ones for computing the latencies of requests
+ */
+extern void afs_stats_trace_event(int pid, struct json_object *event);
+
+/**
+ * Returns a new object with the statistics of the requests of the
+ * api/verb matching 'filter' (keys: api, verb, glob patterns). When
+ * 'filter' has "reset" set, the statistics are cleared after reading.
+ */
+extern struct json_object *afs_stats_query(struct json_object *filter);
@@ -0,0 +1,776 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include <json-c/json.h>
+
+#include <libafb/core/afb-data.h>
+#include <libafb/core/afb-evt.h>
+#include <libafb/core/afb-json-legacy.h>
+#include <libafb/core/afb-ev-mgr.h>
+#include <libafb/misc/afb-verbose.h>
+
+#include <libafb/sys/x-mutex.h>
+#include <libafb/sys/x-errno.h>
+
+#include "afb-supervisor-trace.h"
+#include "afb-supervisor-stats.h"
+
+/* maximal length of recorded names */
+#define TRACE_NAME_MAX 48
+
+/* maximal length of recorded sessions */
+#define TRACE_SESSION_MAX 40
+
+/* maximal length of recorded types and actions */
+#define TRACE_TAG_MAX 16
+
+/* maximal length of the recorded serialization of events */
+#define TRACE_DATA_MAX 512
+
+/* default count of events of batches */
+#define TRACE_BATCH_SIZE 100
+
+/* default maximal delay in ms of batches */
+#define TRACE_BATCH_DELAY_MS 50
+
+/* period in ms of the probing of the subscriptions without push */
+#define TRACE_PROBE_MS 30000
+
+/* flags of the fields of records truncated */
+#define TRUNC_TYPE    1
+#define TRUNC_ACTION  2
+#define TRUNC_API     4
+#define TRUNC_VERB    8
+#define TRUNC_SESSION 16
+
+/* a recorded trace event */
+struct record
+{
+	/* time of reception in ms since epoch */
+	int64_t received_ms;
+
+	/* pid of the daemon */
+	int pid;
+
+	/* index of the request */
+	int index;
+
+	/* length of the serialized event */
+	unsigned length;
+
+	/* fields truncated (TRUNC_...) */
+	unsigned truncated;
+
+	/* type of the event */
+	char type[TRACE_TAG_MAX];
+
+	/* action of the request */
+	char action[TRACE_TAG_MAX];
+
+	/* api of the request */
+	char api[TRACE_NAME_MAX];
+
+	/* verb of the request */
+	char verb[TRACE_NAME_MAX];
+
+	/* session of the request */
+	char session[TRACE_SESSION_MAX];
+
+	/* serialized event, truncated if longer than TRACE_DATA_MAX */
+	char data[TRACE_DATA_MAX];
+};
+
+/*
+ * the ring of records, shared by all the daemons
+ * the newest record evicts the oldest whatever its daemon
+ */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* the preallocated records */
+	struct record *records;
+
+	/* count of records */
+	unsigned size;
+
+	/* index of the next record to write */
+	unsigned head;
+
+	/* count of valid records */
+	unsigned count;
+
+	/* count of received events */
+	uint64_t received;
+}
+	ring = { .mutex = X_MUTEX_INITIALIZER };
+
+/* a filtered subscription to trace events */
+struct subscription
+{
+	/* next subscription */
+	struct subscription *next;
+
+	/* the event pushed to the subscriber */
+	struct afb_evt *evt;
+
+	/* count of references: the list and the armed batch timer */
+	unsigned refcount;
+
+	/* pid of the daemon or 0 for any */
+	int pid;
+
+	/* glob patterns of the filter or NULL for any */
+	char *api;
+	char *verb;
+	char *session;
+	char *type;
+	char *action;
+
+	/* keeps only one request over 'sample' */
+	unsigned sample;
+
+	/* maximal count of events per second or 0 for no limit */
+	unsigned rate;
+
+	/* sampling counter of events not related to requests */
+	unsigned counter;
+
+	/* current second of the rate limit and its count of events */
+	time_t window;
+	unsigned window_count;
+
+	/* maximal count of events of a batch or 0 when not batching */
+	unsigned batch_size;
+
+	/* maximal delay in ms of a batch */
+	unsigned batch_delay;
+
+	/* the pending batch of events or NULL */
+	struct json_object *batch;
+
+	/* is the timer of the batch armed? */
+	int armed;
+
+	/* was nothing pushed since the last probing? */
+	int idle;
+
+	/* callback of the end of the subscription and its closure */
+	void (*ended)(void *closure);
+	void *closure;
+};
+
+/* the filtered subscriptions */
+static struct {
+	/* protection of the list */
+	x_mutex_t mutex;
+
+	/* the list */
+	struct subscription *head;
+
+	/* timer of the probing, armed while subscriptions exist */
+	struct ev_timer *timer;
+
+	/* count of events pushed */
+	uint64_t pushed;
+
+	/* count of messages pushed */
+	uint64_t messages;
+}
+	subscriptions = { .mutex = X_MUTEX_INITIALIZER };
+
+int afs_trace_init(unsigned count)
+{
+	struct record *records;
+
+	if (!count)
+		return 0;
+	records = calloc(count, sizeof *records);
+	if (!records)
+		return X_ENOMEM;
+
+	x_mutex_lock(&ring.mutex);
+	free(ring.records);
+	ring.records = records;
+	ring.size = count;
+	ring.head = ring.count = 0;
+	x_mutex_unlock(&ring.mutex);
+	return 0;
+}
+
+/*
+ * copy the string 'key' of 'obj' to 'dest' of 'size'
+ * return 'flag' if truncated or 0 otherwise
+ */
+static unsigned copy_string(char *dest, size_t size, struct json_object *obj, const char *key, unsigned flag)
+{
+	struct json_object *item;
+	const char *value;
+
+	value = json_object_object_get_ex(obj, key, &item) ? json_object_get_string(item) : NULL;
+	if (!value) {
+		dest[0] = 0;
+		return 0;
+	}
+	strncpy(dest, value, size - 1);
+	dest[size - 1] = 0;
+	return strlen(value) >= size ? flag : 0;
+}
+
+/* records the trace 'event' received from the daemon 'pid' */
+static void record(int pid, struct json_object *event)
+{
+	struct record *rec;
+	struct json_object *request, *item;
+	struct timespec ts;
+	const char *data;
+	size_t length;
+
+	if (!ring.size) {
+		x_mutex_lock(&ring.mutex);
+		ring.received++;
+		x_mutex_unlock(&ring.mutex);
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (!json_object_object_get_ex(event, "request", &request))
+		request = NULL;
+	data = json_object_to_json_string_length(event, JSON_C_TO_STRING_PLAIN, &length);
+
+	x_mutex_lock(&ring.mutex);
+	ring.received++;
+	rec = &ring.records[ring.head];
+	ring.head = ring.head + 1 == ring.size ? 0 : ring.head + 1;
+	if (ring.count < ring.size)
+		ring.count++;
+
+	rec->received_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	rec->pid = pid;
+	rec->index = request && json_object_object_get_ex(request, "index", &item)
+			? json_object_get_int(item) : 0;
+	rec->truncated = copy_string(rec->type, sizeof rec->type, event, "type", TRUNC_TYPE)
+			| copy_string(rec->action, sizeof rec->action, request, "action", TRUNC_ACTION)
+			| copy_string(rec->api, sizeof rec->api, request, "api", TRUNC_API)
+			| copy_string(rec->verb, sizeof rec->verb, request, "verb", TRUNC_VERB)
+			| copy_string(rec->session, sizeof rec->session, request, "session", TRUNC_SESSION);
+	rec->length = (unsigned)length;
+	memcpy(rec->data, data, length < sizeof rec->data ? length : sizeof rec->data);
+	x_mutex_unlock(&ring.mutex);
+}
+
+/*
+ * check if the string 'value' matches the filter 'key'
+ * when 'truncated', only the recorded prefix of 'value' is compared
+ */
+static int match_string(struct json_object *filter, const char *key, const char *value, int truncated)
+{
+	struct json_object *item;
+	const char *expected;
+
+	if (!json_object_object_get_ex(filter, key, &item))
+		return 1;
+	expected = json_object_get_string(item) ?: "";
+	return truncated ? !strncmp(expected, value, strlen(value)) : !strcmp(expected, value);
+}
+
+/* check if the record 'rec' matches the 'filter' */
+static int match(struct json_object *filter, struct record *rec)
+{
+	struct json_object *item;
+
+	if (!filter)
+		return 1;
+	if (json_object_object_get_ex(filter, "pid", &item) && json_object_get_int(item) != rec->pid)
+		return 0;
+	if (json_object_object_get_ex(filter, "since", &item) && json_object_get_int64(item) > rec->received_ms)
+		return 0;
+	if (json_object_object_get_ex(filter, "until", &item) && json_object_get_int64(item) < rec->received_ms)
+		return 0;
+	return match_string(filter, "api", rec->api, rec->truncated & TRUNC_API)
+	    && match_string(filter, "verb", rec->verb, rec->truncated & TRUNC_VERB)
+	    && match_string(filter, "session", rec->session, rec->truncated & TRUNC_SESSION)
+	    && match_string(filter, "type", rec->type, rec->truncated & TRUNC_TYPE)
+	    && match_string(filter, "action", rec->action, rec->truncated & TRUNC_ACTION);
+}
+
+/* make the json array of the names of the fields of 'truncated' */
+static struct json_object *truncated_json(unsigned truncated)
+{
+	static const char *names[] = { "type", "action", "api", "verb", "session" };
+	struct json_object *array;
+	unsigned i;
+
+	array = json_object_new_array();
+	for (i = 0 ; i < sizeof names / sizeof *names ; i++)
+		if (truncated & (1u << i))
+			json_object_array_add(array, json_object_new_string(names[i]));
+	return array;
+}
+
+/* make the json object of the record 'rec' */
+static struct json_object *make_object(struct record *rec)
+{
+	struct json_object *obj, *event;
+
+	obj = json_object_new_object();
+	json_object_object_add(obj, "pid", json_object_new_int(rec->pid));
+	json_object_object_add(obj, "received", json_object_new_int64(rec->received_ms));
+	if (rec->length < sizeof rec->data) {
+		rec->data[rec->length] = 0;
+		event = json_tokener_parse(rec->data);
+		json_object_object_add(obj, "event", event);
+	}
+	else {
+		json_object_object_add(obj, "truncated", json_object_new_boolean(1));
+		json_object_object_add(obj, "type", json_object_new_string(rec->type));
+		json_object_object_add(obj, "index", json_object_new_int(rec->index));
+		json_object_object_add(obj, "api", json_object_new_string(rec->api));
+		json_object_object_add(obj, "verb", json_object_new_string(rec->verb));
+		json_object_object_add(obj, "action", json_object_new_string(rec->action));
+		json_object_object_add(obj, "session", json_object_new_string(rec->session));
+	}
+	if (rec->truncated)
+		json_object_object_add(obj, "truncated-fields", truncated_json(rec->truncated));
+	return obj;
+}
+
+struct json_object *afs_trace_query(struct json_object *filter)
+{
+	struct json_object *result, *item;
+	unsigned i, first, idx, limit, n, skip;
+
+	limit = UINT32_MAX;
+	if (json_object_object_get_ex(filter, "limit", &item) && json_object_get_int(item) > 0)
+		limit = (unsigned)json_object_get_int(item);
+	if (!json_object_is_type(filter, json_type_object))
+		filter = NULL;
+
+	result = json_object_new_array();
+	x_mutex_lock(&ring.mutex);
+
+	/* count the matching records for keeping the newest */
+	first = ring.count < ring.size ? 0 : ring.head;
+	for (n = i = 0, idx = first ; i < ring.count ; i++, idx = idx + 1 == ring.size ? 0 : idx + 1)
+		n += (unsigned)match(filter, &ring.records[idx]);
+	skip = n > limit ? n - limit : 0;
+
+	/* extract them */
+	for (i = 0, idx = first ; i < ring.count ; i++, idx = idx + 1 == ring.size ? 0 : idx + 1) {
+		if (match(filter, &ring.records[idx])) {
+			if (skip)
+				skip--;
+			else
+				json_object_array_add(result, make_object(&ring.records[idx]));
+		}
+	}
+	x_mutex_unlock(&ring.mutex);
+	return result;
+}
+
+/* release the subscription 'sub', subscriptions.mutex held */
+static void subscription_unref(struct subscription *sub)
+{
+	if (--sub->refcount)
+		return;
+	json_object_put(sub->batch);
+	afb_evt_unref(sub->evt);
+	free(sub->api);
+	free(sub->verb);
+	free(sub->session);
+	free(sub->type);
+	free(sub->action);
+	free(sub);
+}
+
+/* get in 'pattern' a copy of the string 'key' of 'filter' */
+static int get_pattern(struct json_object *filter, const char *key, char **pattern)
+{
+	struct json_object *item;
+
+	*pattern = NULL;
+	if (!json_object_object_get_ex(filter, key, &item))
+		return 0;
+	if (!json_object_is_type(item, json_type_string))
+		return X_EINVAL;
+	*pattern = strdup(json_object_get_string(item));
+	return *pattern ? 0 : X_ENOMEM;
+}
+
+/* get in 'value' the positive integer 'key' of 'filter' */
+static int get_count(struct json_object *filter, const char *key, unsigned *value)
+{
+	struct json_object *item;
+
+	*value = 0;
+	if (!json_object_object_get_ex(filter, key, &item))
+		return 0;
+	if (!json_object_is_type(item, json_type_int) || json_object_get_int(item) < 0)
+		return X_EINVAL;
+	*value = (unsigned)json_object_get_int(item);
+	return 0;
+}
+
+/* get in 'sub' the batching setting of 'filter' */
+static int get_batch(struct json_object *filter, struct subscription *sub)
+{
+	struct json_object *batch;
+	int rc;
+
+	if (!json_object_object_get_ex(filter, "batch", &batch))
+		return 0;
+	if (json_object_is_type(batch, json_type_boolean)) {
+		if (json_object_get_boolean(batch)) {
+			sub->batch_size = TRACE_BATCH_SIZE;
+			sub->batch_delay = TRACE_BATCH_DELAY_MS;
+		}
+		return 0;
+	}
+	if (!json_object_is_type(batch, json_type_object))
+		return X_EINVAL;
+	rc = get_count(batch, "size", &sub->batch_size);
+	if (rc >= 0)
+		rc = get_count(batch, "delay", &sub->batch_delay);
+	if (!sub->batch_size)
+		sub->batch_size = TRACE_BATCH_SIZE;
+	if (!sub->batch_delay)
+		sub->batch_delay = TRACE_BATCH_DELAY_MS;
+	return rc;
+}
+
+/* push the probe of 'sub', returns the result of the push */
+static int probe(struct subscription *sub)
+{
+	if (sub->batch_size)
+		return afb_json_legacy_event_push(sub->evt, json_object_new_array());
+	return afb_evt_push(sub->evt, 0, NULL);
+}
+
+/* end the subscriptions of the list 'dead', subscriptions.mutex not held */
+static void end_subscriptions(struct subscription *dead)
+{
+	struct subscription *sub;
+
+	while ((sub = dead)) {
+		dead = sub->next;
+		if (sub->ended)
+			sub->ended(sub->closure);
+		x_mutex_lock(&subscriptions.mutex);
+		subscription_unref(sub);
+		x_mutex_unlock(&subscriptions.mutex);
+	}
+}
+
+/* probe the subscriptions that pushed nothing since the previous probing */
+static void on_probe(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	struct subscription *sub, **prv, *dead;
+
+	dead = NULL;
+	x_mutex_lock(&subscriptions.mutex);
+	prv = &subscriptions.head;
+	while ((sub = *prv)) {
+		if (!sub->idle || probe(sub) > 0) {
+			sub->idle = 1;
+			prv = &sub->next;
+		}
+		else {
+			/* no more subscriber */
+			*prv = sub->next;
+			sub->next = dead;
+			dead = sub;
+		}
+	}
+
+	/* disarm when no more subscription */
+	if (!subscriptions.head) {
+		ev_timer_unref(subscriptions.timer);
+		subscriptions.timer = NULL;
+	}
+	x_mutex_unlock(&subscriptions.mutex);
+	end_subscriptions(dead);
+}
+
+int afs_trace_subscribe(struct afb_evt *evt, struct json_object *filter, void (*ended)(void *closure), void *closure)
+{
+	struct subscription *sub;
+	struct json_object *item;
+	int rc;
+
+	if (!json_object_is_type(filter, json_type_object))
+		return X_EINVAL;
+	sub = calloc(1, sizeof *sub);
+	if (!sub)
+		return X_ENOMEM;
+
+	rc = 0;
+	if (json_object_object_get_ex(filter, "pid", &item)) {
+		sub->pid = json_object_get_int(item);
+		if (sub->pid <= 0)
+			rc = X_EINVAL;
+	}
+	if (rc >= 0)
+		rc = get_pattern(filter, "api", &sub->api);
+	if (rc >= 0)
+		rc = get_pattern(filter, "verb", &sub->verb);
+	if (rc >= 0)
+		rc = get_pattern(filter, "session", &sub->session);
+	if (rc >= 0)
+		rc = get_pattern(filter, "type", &sub->type);
+	if (rc >= 0)
+		rc = get_pattern(filter, "action", &sub->action);
+	if (rc >= 0)
+		rc = get_count(filter, "sample", &sub->sample);
+	if (rc >= 0)
+		rc = get_count(filter, "rate", &sub->rate);
+	if (rc >= 0)
+		rc = get_batch(filter, sub);
+	sub->evt = afb_evt_addref(evt);
+	sub->refcount = 1;
+	if (rc < 0) {
+		subscription_unref(sub);
+		return rc;
+	}
+
+	x_mutex_lock(&subscriptions.mutex);
+	if (!subscriptions.timer
+	 && afb_ev_mgr_add_timer(&subscriptions.timer, 0,
+			TRACE_PROBE_MS / 1000, TRACE_PROBE_MS % 1000,
+			0, TRACE_PROBE_MS, TRACE_PROBE_MS / 10, on_probe, NULL, 0) < 0) {
+		LIBAFB_WARNING("can't probe the filtered subscriptions to trace events");
+		subscriptions.timer = NULL;
+	}
+	sub->ended = ended;
+	sub->closure = closure;
+	sub->next = subscriptions.head;
+	subscriptions.head = sub;
+	x_mutex_unlock(&subscriptions.mutex);
+	return 0;
+}
+
+/* check if the string 'key' of 'obj' matches the glob 'pattern' */
+static int match_pattern(const char *pattern, struct json_object *obj, const char *key)
+{
+	struct json_object *item;
+	const char *value;
+
+	if (!pattern)
+		return 1;
+	value = json_object_object_get_ex(obj, key, &item) ? json_object_get_string(item) : NULL;
+	return value && !fnmatch(pattern, value, 0);
+}
+
+/* check if the 'event' of 'pid' at second 'now' is to be pushed to 'sub' */
+static int selected(struct subscription *sub, int pid, struct json_object *event, struct json_object *request, time_t now)
+{
+	struct json_object *item;
+	unsigned index;
+
+	/* filter */
+	if ((sub->pid && sub->pid != pid)
+	 || !match_pattern(sub->type, event, "type")
+	 || !match_pattern(sub->api, request, "api")
+	 || !match_pattern(sub->verb, request, "verb")
+	 || !match_pattern(sub->session, request, "session")
+	 || !match_pattern(sub->action, request, "action"))
+		return 0;
+
+	/* sample on the index of requests for keeping all their events */
+	if (sub->sample > 1) {
+		if (json_object_object_get_ex(request, "index", &item))
+			index = (unsigned)json_object_get_int(item);
+		else
+			index = sub->counter++;
+		if (index % sub->sample)
+			return 0;
+	}
+
+	/* limit the rate */
+	if (sub->rate) {
+		if (sub->window != now) {
+			sub->window = now;
+			sub->window_count = 0;
+		}
+		if (sub->window_count >= sub->rate)
+			return 0;
+		sub->window_count++;
+	}
+	return 1;
+}
+
+/* push the pending batch of 'sub', returns the result of the push */
+static int flush(struct subscription *sub)
+{
+	struct json_object *batch = sub->batch;
+
+	sub->batch = NULL;
+	subscriptions.messages++;
+	return afb_json_legacy_event_push(sub->evt, batch);
+}
+
+/* remove 'sub' from the list of subscriptions, returns 1 if it was listed */
+static int unlink_subscription(struct subscription *sub)
+{
+	struct subscription **prv;
+
+	for (prv = &subscriptions.head ; *prv ; prv = &(*prv)->next) {
+		if (*prv == sub) {
+			*prv = sub->next;
+			sub->next = NULL;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* flush the batch of the subscription 'closure' when its delay expires */
+static void on_batch_delay(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	struct subscription *sub = closure, *dead;
+
+	dead = NULL;
+	x_mutex_lock(&subscriptions.mutex);
+	sub->armed = 0;
+	if (sub->batch && flush(sub) <= 0 && unlink_subscription(sub))
+		dead = sub;
+	subscription_unref(sub);
+	x_mutex_unlock(&subscriptions.mutex);
+	end_subscriptions(dead);
+}
+
+/* add the 'event' to the batch of 'sub', returns the result of a push or 1 */
+static int batch(struct subscription *sub, struct json_object *event)
+{
+	struct ev_timer *timer;
+
+	if (!sub->batch) {
+		sub->batch = json_object_new_array();
+		if (!sub->batch)
+			return 1;
+	}
+	json_object_array_add(sub->batch, json_object_get(event));
+	if (json_object_array_length(sub->batch) >= sub->batch_size)
+		return flush(sub);
+	if (!sub->armed) {
+		if (afb_ev_mgr_add_timer(&timer, 0,
+				(time_t)(sub->batch_delay / 1000), sub->batch_delay % 1000,
+				1, 0, sub->batch_delay / 10 ?: 1, on_batch_delay, sub, 1) < 0)
+			return flush(sub);
+		sub->armed = 1;
+		sub->refcount++;
+	}
+	return 1;
+}
+
+/* the trace event being dispatched */
+struct dispatch
+{
+	/* pid of the daemon */
+	int pid;
+
+	/* count of parameters of the event */
+	unsigned nparams;
+
+	/* parameters of the event */
+	struct afb_data * const *params;
+};
+
+/* push the 'event' to the subscriptions selecting it */
+static void push(struct dispatch *dispatch, struct json_object *event)
+{
+	struct subscription *sub, **prv, *dead;
+	struct json_object *request;
+	struct timespec ts;
+	unsigned i;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	if (!json_object_object_get_ex(event, "request", &request))
+		request = NULL;
+
+	dead = NULL;
+	x_mutex_lock(&subscriptions.mutex);
+	prv = &subscriptions.head;
+	while ((sub = *prv)) {
+		if (!selected(sub, dispatch->pid, event, request, ts.tv_sec))
+			prv = &sub->next;
+		else {
+			sub->idle = 0;
+			subscriptions.pushed++;
+			if (sub->batch_size)
+				rc = batch(sub, event);
+			else {
+				for (i = 0 ; i < dispatch->nparams ; i++)
+					afb_data_addref(dispatch->params[i]);
+				rc = afb_evt_push(sub->evt, dispatch->nparams, dispatch->params);
+				subscriptions.messages++;
+			}
+			if (rc > 0)
+				prv = &sub->next;
+			else {
+				/* no more subscriber */
+				*prv = sub->next;
+				sub->next = dead;
+				dead = sub;
+			}
+		}
+	}
+	x_mutex_unlock(&subscriptions.mutex);
+	end_subscriptions(dead);
+}
+
+static void on_event(void *closure, struct json_object *event)
+{
+	struct dispatch *dispatch = closure;
+
+	record(dispatch->pid, event);
+	afs_stats_trace_event(dispatch->pid, event);
+	if (subscriptions.head)
+		push(dispatch, event);
+}
+
+void afs_trace_dispatch(int pid, unsigned nparams, struct afb_data * const params[])
+{
+	struct dispatch dispatch;
+
+	dispatch.pid = pid;
+	dispatch.nparams = nparams;
+	dispatch.params = params;
+	afb_json_legacy_do_single_json_c(nparams, params, on_event, &dispatch);
+}
+
+void afs_trace_get_stats(struct afs_trace_stats *stats)
+{
+	x_mutex_lock(&ring.mutex);
+	stats->received = ring.received;
+	x_mutex_unlock(&ring.mutex);
+	x_mutex_lock(&subscriptions.mutex);
+	stats->pushed = subscriptions.pushed;
+	stats->messages = subscriptions.messages;
+	x_mutex_unlock(&subscriptions.mutex);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct json_object;
+struct afb_evt;
+struct afb_data;
+
+/**
+ * counters of the trace events
+ */
+struct afs_trace_stats
+{
+	/* count of events received from daemons */
+	uint64_t received;
+
+	/* count of events pushed to filtered subscriptions */
+	uint64_t pushed;
+
+	/* count of messages pushed to filtered subscriptions */
+	uint64_t messages;
+};
+
+/**
+ * Allocates the ring buffer of trace events for 'count' events.
+ * A count of zero disables the recording.
+ * Returns 0 on success or a negative error code.
+ */
+extern int afs_trace_init(unsigned count);
+
+/**
+ * Records the trace event of 'params' received from the daemon 'pid',
+ * accounts it in the statistics of requests and pushes it to the
+ * filtered subscriptions selecting it.
+ */
+extern void afs_trace_dispatch(int pid, unsigned nparams, struct afb_data * const params[]);
+
+/**
+ * Adds a subscription pushing on 'evt' the trace events selected by
+ * 'filter' (keys: pid, api, verb, session, type, action, sample, rate,
+ * batch). When batching, the events are pushed by arrays.
+ * The subscription is dropped when 'evt' has no more listener: a
+ * subscription that pushed nothing during a period is probed by
+ * pushing an event without data (an empty array when batching).
+ * When dropped, 'ended' is called with 'closure' if not NULL.
+ * Returns 0 on success or a negative error code, 'ended' being
+ * then not called.
+ */
+extern int afs_trace_subscribe(
+		struct afb_evt *evt,
+		struct json_object *filter,
+		void (*ended)(void *closure),
+		void *closure);
+
+/**
+ * Queries the recorded events matching 'filter' (keys: pid, api, verb,
+ * session, type, action, since, until, limit) and returns them
+ * in a new array from the oldest to the newest.
+ */
+extern struct json_object *afs_trace_query(struct json_object *filter);
+
+/**
+ * Reads the counters of the trace events in 'stats'
+ */
+extern void afs_trace_get_stats(struct afs_trace_stats *stats);
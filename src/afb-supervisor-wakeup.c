@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+
+#include <libafb/sys/ev-mgr.h>
+#include <libafb/core/afb-ev-mgr.h>
+#include <libafb/misc/afb-verbose.h>
+#include <libafb/sys/x-mutex.h>
+#include <libafb/sys/x-errno.h>
+
+#include "afb-supervisor-wakeup.h"
+
+/* count of buckets for searching pids (must be a power of 2) */
+#define WAKEUP_BUCKETS 256
+
+/* a daemon to wake up */
+struct wakeup
+{
+	/* next in the queue */
+	struct wakeup *next;
+
+	/* next in the bucket */
+	struct wakeup *next_pid;
+
+	/* time of the last signal in ms */
+	uint64_t signaled_ms;
+
+	/* pid of the daemon */
+	pid_t pid;
+
+	/* count of signals sent */
+	unsigned tries;
+
+	/* is it connected? */
+	int connected;
+};
+
+/* queue of wakeups */
+struct queue
+{
+	struct wakeup *head;
+	struct wakeup **tail;
+	unsigned count;
+};
+
+/* the wake-up pacer */
+static struct {
+	/* protection of the data */
+	x_mutex_t mutex;
+
+	/* timer of the pacing, armed while daemons are queued */
+	struct ev_timer *timer;
+
+	/* period of the pacing in ms, 0 when not paced */
+	unsigned period_ms;
+
+	/* count of signals per tick */
+	unsigned batch;
+
+	/* timeout of connection in ms */
+	unsigned timeout_ms;
+
+	/* maximal count of signals per daemon */
+	unsigned retries;
+
+	/* checks if a pid is supervised */
+	int (*is_supervised)(pid_t pid);
+
+	/* checks if a pid is still a daemon */
+	int (*is_daemon)(pid_t pid);
+
+	/* daemons waiting to be signaled */
+	struct queue pending;
+
+	/* daemons signaled waiting to connect */
+	struct queue waiting;
+
+	/* buckets of daemons by pid */
+	struct wakeup *buckets[WAKEUP_BUCKETS];
+
+	/* counters */
+	struct afs_wakeup_stats stats;
+}
+	pacer = {
+		.mutex = X_MUTEX_INITIALIZER,
+		.pending = { .head = NULL, .tail = &pacer.pending.head },
+		.waiting = { .head = NULL, .tail = &pacer.waiting.head }
+	};
+
+/* get the current monotonic time in ms */
+static uint64_t now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* search the wakeup of 'pid', the pacer must be locked */
+static struct wakeup **search_locked(pid_t pid)
+{
+	struct wakeup **pw = &pacer.buckets[(unsigned)pid & (WAKEUP_BUCKETS - 1)];
+	while (*pw && (*pw)->pid != pid)
+		pw = &(*pw)->next_pid;
+	return pw;
+}
+
+/* append 'w' to the 'queue' */
+static void enqueue(struct queue *queue, struct wakeup *w)
+{
+	w->next = NULL;
+	*queue->tail = w;
+	queue->tail = &w->next;
+	queue->count++;
+}
+
+/* remove the head of the 'queue' and return it */
+static struct wakeup *dequeue(struct queue *queue)
+{
+	struct wakeup *w = queue->head;
+	if (w) {
+		queue->head = w->next;
+		if (!queue->head)
+			queue->tail = &queue->head;
+		queue->count--;
+	}
+	return w;
+}
+
+/* forget 'w', the pacer must be locked */
+static void forget_locked(struct wakeup *w)
+{
+	struct wakeup **pw = search_locked(w->pid);
+	if (*pw == w)
+		*pw = w->next_pid;
+	free(w);
+}
+
+/* signal the daemon of 'w' */
+static void signal_daemon(struct wakeup *w)
+{
+	if (kill(w->pid, SIGHUP) < 0)
+		LIBAFB_DEBUG("can't signal daemon %d: %s", (int)w->pid, strerror(errno));
+	w->signaled_ms = now_ms();
+	if (w->tries++)
+		pacer.stats.retried++;
+	pacer.stats.signaled++;
+}
+
+/* a tick of the pacing */
+static void tick(struct ev_timer *timer, void *closure, unsigned decount)
+{
+	struct wakeup *w;
+	uint64_t now;
+	unsigned n;
+
+	x_mutex_lock(&pacer.mutex);
+
+	/* check the daemons signaled */
+	now = now_ms();
+	while ((w = pacer.waiting.head)
+	    && (w->connected || w->signaled_ms + pacer.timeout_ms <= now)) {
+		dequeue(&pacer.waiting);
+		if (w->connected || pacer.is_supervised(w->pid)) {
+			pacer.stats.connected++;
+			forget_locked(w);
+		}
+		else if (w->tries >= pacer.retries || kill(w->pid, 0) < 0) {
+			pacer.stats.abandoned++;
+			forget_locked(w);
+		}
+		else
+			enqueue(&pacer.pending, w);
+	}
+
+	/* signal a batch of daemons */
+	for (n = 0 ; n < pacer.batch && (w = dequeue(&pacer.pending)) ; ) {
+		if (pacer.is_supervised(w->pid))
+			forget_locked(w);
+		else if (!pacer.is_daemon(w->pid)) {
+			pacer.stats.abandoned++;
+			forget_locked(w);
+		}
+		else {
+			signal_daemon(w);
+			enqueue(&pacer.waiting, w);
+			n++;
+		}
+	}
+
+	/* disarm when drained */
+	if (!pacer.pending.count && !pacer.waiting.count) {
+		ev_timer_unref(pacer.timer);
+		pacer.timer = NULL;
+	}
+
+	x_mutex_unlock(&pacer.mutex);
+}
+
+/* arm the timer of the pacing, the pacer must be locked */
+static int arm_locked()
+{
+	int rc;
+
+	rc = afb_ev_mgr_add_timer(&pacer.timer, 0,
+			(time_t)(pacer.period_ms / 1000), pacer.period_ms % 1000,
+			0, pacer.period_ms, pacer.period_ms / 10 ?: 1, tick, NULL, 0);
+	if (rc < 0)
+		pacer.timer = NULL;
+	return rc;
+}
+
+int afs_wakeup_start(
+	unsigned rate,
+	unsigned batch,
+	unsigned timeout_ms,
+	unsigned retries,
+	int (*is_supervised)(pid_t pid),
+	int (*is_daemon)(pid_t pid)
+) {
+	if (pacer.period_ms || !rate)
+		return 0;
+
+	pacer.batch = batch ?: 1;
+	pacer.timeout_ms = timeout_ms;
+	pacer.retries = retries ?: 1;
+	pacer.is_supervised = is_supervised;
+	pacer.is_daemon = is_daemon;
+	pacer.period_ms = (1000 * pacer.batch) / rate ?: 1;
+	return 0;
+}
+
+void afs_wakeup_request(pid_t pid)
+{
+	struct wakeup *w, **pw;
+
+	/* not paced? */
+	if (!pacer.period_ms) {
+		kill(pid, SIGHUP);
+		return;
+	}
+
+	x_mutex_lock(&pacer.mutex);
+	pw = search_locked(pid);
+	if (!*pw) {
+		w = pacer.timer || arm_locked() >= 0 ? malloc(sizeof *w) : NULL;
+		if (!w)
+			kill(pid, SIGHUP);
+		else {
+			w->pid = pid;
+			w->tries = 0;
+			w->connected = 0;
+			w->signaled_ms = 0;
+			w->next_pid = NULL;
+			*pw = w;
+			enqueue(&pacer.pending, w);
+			pacer.stats.queued++;
+		}
+	}
+	x_mutex_unlock(&pacer.mutex);
+}
+
+void afs_wakeup_connected(pid_t pid)
+{
+	struct wakeup *w;
+
+	x_mutex_lock(&pacer.mutex);
+	w = *search_locked(pid);
+	if (w)
+		w->connected = 1;
+	x_mutex_unlock(&pacer.mutex);
+}
+
+void afs_wakeup_get_stats(struct afs_wakeup_stats *stats)
+{
+	x_mutex_lock(&pacer.mutex);
+	*stats = pacer.stats;
+	stats->pending = pacer.pending.count;
+	stats->waiting = pacer.waiting.count;
+	x_mutex_unlock(&pacer.mutex);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015-2025 IoT.bzh Company
+ *
+ * $RP_BEGIN_LICENSE$
+ * Commercial License Usage
+ *  Licensees holding valid commercial IoT.bzh licenses may use this file in
+ *  accordance with the commercial license agreement provided with the
+ *  Software or, alternatively, in accordance with the terms contained in
+ *  a written agreement between you and The IoT.bzh Company. For licensing terms
+ *  and conditions see https://www.iot.bzh/terms-conditions. For further
+ *  information use the contact form at https://www.iot.bzh/contact.
+ * 
+ * GNU General Public License Usage
+ *  Alternatively, this file may be used under the terms of the GNU General
+ *  Public license version 3. This license is as published by the Free Software
+ *  Foundation and appearing in the file LICENSE.GPLv3 included in the packaging
+ *  of this file. Please review the following information to ensure the GNU
+ *  General Public License requirements will be met
+ *  https://www.gnu.org/licenses/gpl-3.0.html.
+ * $RP_END_LICENSE$
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * counters of the wake-up queue
+ */
+struct afs_wakeup_stats
+{
+	/* count of daemons queued */
+	uint64_t queued;
+
+	/* count of signals sent */
+	uint64_t signaled;
+
+	/* count of signals sent again after a timeout */
+	uint64_t retried;
+
+	/* count of signaled daemons that connected */
+	uint64_t connected;
+
+	/* count of daemons given up */
+	uint64_t abandoned;
+
+	/* current count of daemons waiting a signal */
+	unsigned pending;
+
+	/* current count of signaled daemons waiting connection */
+	unsigned waiting;
+};
+
+/**
+ * Starts the pacing of wake-ups at 'rate' signals per second
+ * sent by batches of 'batch' signals. Signaled daemons not
+ * connected after 'timeout_ms' are signaled again up to
+ * 'retries' times. The function 'is_supervised' tells whether
+ * a pid is already supervised and the function 'is_daemon' whether
+ * a pid is still a daemon: it is checked before each signal because
+ * the pid may have been reused while queued.
+ * When 'rate' is zero, signals are sent immediately.
+ * The pacing only ticks while daemons are queued.
+ * Returns 0 on success or a negative error code.
+ */
+extern int afs_wakeup_start(
+		unsigned rate,
+		unsigned batch,
+		unsigned timeout_ms,
+		unsigned retries,
+		int (*is_supervised)(pid_t pid),
+		int (*is_daemon)(pid_t pid));
+
+/**
+ * Queues the wake-up of the daemon 'pid'
+ */
+extern void afs_wakeup_request(pid_t pid);
+
+/**
+ * Records that the daemon 'pid' connected
+ */
+extern void afs_wakeup_connected(pid_t pid);
+
+/**
+ * Reads the counters of the wake-up queue in 'stats'
+ */
+extern void afs_wakeup_get_stats(struct afs_wakeup_stats *stats);
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -38,6 +39,7 @@
 #include <libafb/core/afb-session.h>
 
 #if WITH_LIBMICROHTTPD
+#include <microhttpd.h>
 #include <libafb/http/afb-hsrv.h>
 #include <libafb/http/afb-hswitch.h>
 #include <libafb/http/afb-hreq.h>
@@ -47,6 +49,9 @@
 
 #include "afb-supervisor-api.h"
 #include "afb-supervisor-opts.h"
+#include "afb-discover.h"
+#include "afb-supervisor-handoff.h"
+#include "afb-supervisor-federation.h"
 
 #include <libafb/misc/afb-verbose.h>
 #include <libafb/core/afb-sched.h>
@@ -57,17 +62,55 @@
 #  define DEFAULT_SUPERVISOR_INTERFACE NULL
 #endif
 
+/* count of wake-up signals sent to a daemon before giving up */
+#define WAKEUP_RETRIES 3
+
+/* file of the snapshot of the superviseds in the working directory */
+#define SNAPSHOT_FILE "supervised.snapshot"
+
+/* delay in ms of the full discovery after a warm start */
+#define WARM_DISCOVER_DELAY_MS 1000
+
 /* the main config */
 struct optargs *main_config;
 
 /* the main apiset */
 struct afb_apiset *main_apiset;
 
+/* the apiset served to the parent supervisor */
+static struct afb_apiset *upstream_apiset;
+
 /*************************************************************************************/
 
 #if WITH_LIBMICROHTTPD
+/* path of the metrics of the supervisor */
+#define METRICS_PATH "/metrics"
+
+/*
+ * serves the metrics in text exposition format of Prometheus
+ */
+static int metrics_handler(struct afb_hreq *hreq, void *data)
+{
+	char *text;
+	size_t length;
+
+	if (hreq->lentail > 1 || (hreq->lentail == 1 && hreq->tail[0] != '/'))
+		return 0;
+
+	if (afs_supervisor_metrics_text(&text, &length) < 0)
+		afb_hreq_reply_error(hreq, MHD_HTTP_INTERNAL_SERVER_ERROR);
+	else
+		afb_hreq_reply_free(hreq, MHD_HTTP_OK, length, text,
+			MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4", NULL);
+	return 1;
+}
+
 static int init_http_server(struct afb_hsrv *hsrv)
 {
+	if (!afb_hsrv_add_handler
+	    (hsrv, METRICS_PATH, metrics_handler, NULL, 30))
+		return 0;
+
 	if (!afb_hsrv_add_handler
 	    (hsrv, main_config->rootapi, afb_hswitch_upgrade, main_apiset, 20))
 		return 0;
@@ -170,6 +213,15 @@ static void start(int signum, void *arg)
 	}
 
 	/* init the main apiset */
+	afs_supervisor_set_socket(main_config->supervision_socket);
+	if (afs_supervisor_set_trace_ring((unsigned)main_config->trace_ring) < 0)
+		LIBAFB_WARNING("Can't allocate the ring of trace events");
+	afs_supervisor_set_cache_ttl((unsigned)main_config->cache_ttl);
+	afs_supervisor_set_coalescing((unsigned)main_config->coalesce);
+	if (afs_supervisor_probe((unsigned)main_config->probe_period,
+				(unsigned)main_config->probe_stall,
+				main_config->probe_verb) < 0)
+		LIBAFB_WARNING("Can't probe the daemons");
 	rc = afs_supervisor_add(main_apiset, main_apiset);
 	if (rc < 0) {
 		LIBAFB_ERROR("Can't create supervision's apiset: %m");
@@ -185,6 +237,27 @@ static void start(int signum, void *arg)
 		}
 	}
 
+	/* accept the registration of child supervisors */
+	if (main_config->federation) {
+		rc = afs_federation_listen(main_config->federation);
+		if (rc < 0) {
+			LIBAFB_ERROR("Can't listen child supervisors on %s: %s", main_config->federation, strerror(-rc));
+			goto error;
+		}
+	}
+
+	/* register with the parent supervisor */
+	if (main_config->upstream) {
+		upstream_apiset = afb_apiset_create("upstream", main_config->apiTimeout);
+		rc = upstream_apiset ? afs_supervisor_add_upstream(upstream_apiset) : -ENOMEM;
+		if (rc >= 0)
+			rc = afs_federation_upstream(main_config->upstream, main_config->node, upstream_apiset);
+		if (rc < 0) {
+			LIBAFB_ERROR("Can't register with the parent supervisor %s: %s", main_config->upstream, strerror(-rc));
+			goto error;
+		}
+	}
+
 	/* start the services */
 	if (afb_apiset_start_all_services(main_apiset) < 0)
 		goto error;
@@ -217,8 +290,38 @@ static void start(int signum, void *arg)
 		LIBAFB_ERROR("can't start the watchdog");
 #endif
 
-	/* discover binders */
-	afs_supervisor_discover();
+	/* set the scanned processes */
+	afs_discover_set_root(main_config->proc_root);
+
+	/* pace the wake-up of binders */
+	if (afs_supervisor_pace_wakeups((unsigned)main_config->wakeup_rate,
+				(unsigned)main_config->wakeup_batch,
+				(unsigned)main_config->wakeup_timeout,
+				WAKEUP_RETRIES) < 0)
+		LIBAFB_WARNING("Can't pace wake-ups, signaling immediately");
+
+	/* watch binders starting */
+	if (main_config->discover_watch) {
+		rc = afs_supervisor_watch();
+		if (rc < 0)
+			LIBAFB_WARNING("Can't watch starting daemons, %s", strerror(-rc));
+	}
+
+	/* wake up first the binders supervised by the previous instance */
+	rc = afs_supervisor_warm_start(SNAPSHOT_FILE);
+	if (rc < 0)
+		LIBAFB_WARNING("Can't open the snapshot %s, %s", SNAPSHOT_FILE, strerror(-rc));
+
+	/* refresh the index of sessions */
+	if (afs_supervisor_set_session_refresh((unsigned)main_config->session_refresh) < 0)
+		LIBAFB_WARNING("Can't refresh the index of sessions");
+
+	/* discover binders, in background after a warm start */
+	if (rc <= 0 || afs_supervisor_discover_later(WARM_DISCOVER_DELAY_MS) < 0)
+		afs_supervisor_discover();
+	if (afs_supervisor_auto_discover((unsigned)main_config->discover_period,
+				(unsigned)main_config->discover_period_max) < 0)
+		LIBAFB_WARNING("Can't start automatic discovery");
 	return;
 error:
 	exit(1);
@@ -229,6 +332,9 @@ error:
  */
 int main(int ac, char **av)
 {
+	/* record the arguments and the inherited sockets for handoffs */
+	afs_handoff_init(ac, av);
+
 	/* scan arguments */
 	main_config = optargs_parse(ac, av);
 	if (main_config->name) {